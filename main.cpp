@@ -1,10 +1,36 @@
 #include <raylib.h>
 #include <vector>
+#include <algorithm>
 #include <sys/types.h>
 #include <dirent.h>
 #include <stdint.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <assert.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#include <cstddef>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+#include <errno.h>
+#else
+#include <malloc.h>
+#endif
 
 #include "raylib.h"
 #include "raymath.h"
@@ -19,183 +45,2428 @@ enum _ANIM
     LOOP
 };
 
+enum _INPUT
+{
+    INPUT_MOUSE = 1 << 0,
+    INPUT_PAUSE = 1 << 1,
+    INPUT_SHOOT = 1 << 2,
+    INPUT_BOOST = 1 << 3,
+    INPUT_DOWN = 1 << 4,
+    INPUT_UP = 1 << 5,
+    INPUT_RIGHT = 1 << 6,
+    INPUT_LEFT = 1 << 7
+};
+
 enum _CONTAINER
 {
-    ASTEROIDS,
-    PROJECTILES,
-    ENEMYPROJECTILES,
-    EXPLOSIONS
-};
+    ASTEROIDS,
+    PROJECTILES,
+    ENEMYPROJECTILES,
+    EXPLOSIONS,
+    ENEMIES,
+    CONTAINERS
+};
+
+// pool sizes, see pool_t
+#define MAX_ASTEROIDS 4096
+#define MAX_PROJECTILES 1024
+#define MAX_ENEMY_PROJECTILES 256
+#define MAX_ENEMIES 256
+#define MAX_EXPLOSIONS 512
+#define MAX_POWERUPS 128
+
+// heap allocation tracking. every operator new bumps a process wide and a
+// per thread counter, trace zones charge whatever their thread allocated while
+// they were open to their name. --alloc-check fails on any of it after warm-up.
+// raylib allocates through malloc and is not counted
+#define ALLOC_ZONES 64
+
+struct alloc_zone_t
+{
+    const char *name;
+    uint64_t count;
+};
+
+struct
+{
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> bytes{0};
+    // by the threads that run the sim, the main thread, the sim thread and
+    // the job workers. --alloc-check and --soak watch this one
+    std::atomic<uint64_t> game{0};
+    std::mutex lock;
+    alloc_zone_t zones[ALLOC_ZONES];
+    int used = 0;
+} alloc_stats;
+
+thread_local uint64_t alloc_thread_count = 0;
+thread_local bool alloc_game_thread = false;
+
+void alloc_count(size_t size)
+{
+    alloc_stats.count.fetch_add(1, std::memory_order_relaxed);
+    alloc_stats.bytes.fetch_add(size, std::memory_order_relaxed);
+    alloc_thread_count++;
+    if (alloc_game_thread)
+        alloc_stats.game.fetch_add(1, std::memory_order_relaxed);
+}
+
+// every replaceable form the target standards declare, so nothing bypasses the
+// counters and every block goes back to the allocator that made it. they
+// stay out of line, inlined into callers g++ pairs the malloc it sees in one
+// with the operator delete of the other and warns about a mismatch
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    alloc_count(size);
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+__attribute__((noinline)) void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    alloc_count(size);
+    return malloc(size ? size : 1);
+}
+
+__attribute__((noinline)) void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+#if __cpp_sized_deallocation
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+#endif
+
+#if __cpp_aligned_new
+void *alloc_aligned(size_t size, std::align_val_t align)
+{
+    alloc_count(size);
+    size_t alignment = std::max((size_t)align, sizeof(void *));
+#ifdef _WIN32
+    return _aligned_malloc(size ? size : 1, alignment);
+#else
+    void *p = nullptr;
+    return posix_memalign(&p, alignment, size ? size : 1) ? nullptr : p;
+#endif
+}
+
+__attribute__((noinline)) void free_aligned(void *p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+__attribute__((noinline)) void *operator new(size_t size, std::align_val_t align)
+{
+    void *p = alloc_aligned(size, align);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void *operator new[](size_t size, std::align_val_t align)
+{
+    return operator new(size, align);
+}
+
+__attribute__((noinline)) void *operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return alloc_aligned(size, align);
+}
+
+__attribute__((noinline)) void *operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return alloc_aligned(size, align);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::align_val_t) noexcept
+{
+    free_aligned(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, std::align_val_t) noexcept
+{
+    free_aligned(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+    free_aligned(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, size_t, std::align_val_t) noexcept
+{
+    free_aligned(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    free_aligned(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    free_aligned(p);
+}
+#endif
+
+// nested zones all get charged, the counts are inclusive
+void alloc_zone_add(const char *name, uint64_t count)
+{
+    std::lock_guard<std::mutex> guard(alloc_stats.lock);
+    for (int i = 0; i < alloc_stats.used; i++)
+    {
+        if (!strcmp(alloc_stats.zones[i].name, name))
+        {
+            alloc_stats.zones[i].count += count;
+            return;
+        }
+    }
+    if (alloc_stats.used < ALLOC_ZONES)
+        alloc_stats.zones[alloc_stats.used++] = {name, count};
+}
+
+void alloc_zones_reset()
+{
+    std::lock_guard<std::mutex> guard(alloc_stats.lock);
+    for (int i = 0; i < alloc_stats.used; i++)
+        alloc_stats.zones[i].count = 0;
+}
+
+// frame arena for scratch data that dies with the frame. allocating is a
+// pointer bump, frame_arena.reset() at the top of every frame drops it all.
+// released memory is poisoned, under ASan touching it is reported and debug
+// builds fill it with 0xCD. when the arena runs out frame_vector falls back to
+// the heap, which --alloc-check then reports
+#define FRAME_ARENA_SIZE (1 << 20)
+
+#if defined(__SANITIZE_ADDRESS__)
+#define ARENA_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define ARENA_ASAN 1
+#endif
+#endif
+#ifdef ARENA_ASAN
+#include <sanitizer/asan_interface.h>
+#define ARENA_POISON(p, n) ASAN_POISON_MEMORY_REGION(p, n)
+#define ARENA_UNPOISON(p, n) ASAN_UNPOISON_MEMORY_REGION(p, n)
+#else
+#define ARENA_POISON(p, n)
+#define ARENA_UNPOISON(p, n)
+#endif
+
+// alloc() is safe to call from the job workers, reset() is not
+struct arena_t
+{
+    uint8_t *base;
+    size_t size;
+    std::atomic<size_t> used;
+    // high water mark and failed allocations since start
+    std::atomic<size_t> peak;
+    std::atomic<size_t> overflows;
+
+    arena_t(uint8_t *base, size_t size) : base(base), size(size), used(0), peak(0), overflows(0) {}
+
+    // nullptr when full
+    void *alloc(size_t bytes, size_t align = alignof(std::max_align_t))
+    {
+        size_t old = used.load(std::memory_order_relaxed);
+        size_t begin;
+        do
+        {
+            begin = (old + align - 1) & ~(align - 1);
+            if (begin + bytes > size)
+            {
+                overflows++;
+                return nullptr;
+            }
+        } while (!used.compare_exchange_weak(old, begin + bytes, std::memory_order_relaxed));
+
+        size_t high = peak.load(std::memory_order_relaxed);
+        while (begin + bytes > high && !peak.compare_exchange_weak(high, begin + bytes, std::memory_order_relaxed))
+            ;
+        ARENA_UNPOISON(base + begin, bytes);
+        return base + begin;
+    }
+
+    bool owns(const void *p) const
+    {
+        return p >= base && p < base + size;
+    }
+
+    void reset()
+    {
+#ifndef NDEBUG
+        ARENA_UNPOISON(base, used.load());
+        memset(base, 0xCD, used.load());
+#endif
+        ARENA_POISON(base, size);
+        used = 0;
+    }
+};
+
+alignas(64) uint8_t frame_arena_memory[FRAME_ARENA_SIZE];
+arena_t frame_arena(frame_arena_memory, FRAME_ARENA_SIZE);
+
+// STL adapter, deallocate only gives back heap fallbacks
+template <typename T>
+struct arena_allocator_t
+{
+    typedef T value_type;
+    arena_t *arena;
+
+    arena_allocator_t(arena_t *arena = &frame_arena) : arena(arena) {}
+    template <typename U>
+    arena_allocator_t(const arena_allocator_t<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t n)
+    {
+        void *p = arena->alloc(n * sizeof(T), alignof(T));
+        return (T *)(p ? p : ::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        if (!arena->owns(p))
+            ::operator delete(p);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const arena_allocator_t<T> &a, const arena_allocator_t<U> &b)
+{
+    return a.arena == b.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const arena_allocator_t<T> &a, const arena_allocator_t<U> &b)
+{
+    return a.arena != b.arena;
+}
+
+template <typename T>
+using frame_vector = std::vector<T, arena_allocator_t<T>>;
+
+// frame tracing. TRACE_ZONE("name") times the enclosing scope into a ring of
+// the calling thread, the rings always hold the last TRACE_RING zones per
+// thread and trace_dump() writes them as Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev). a zone costs two clock reads and a store
+#define TRACE_RING 16384
+// threads past that many live ones aren't traced
+#define TRACE_THREADS 256
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+#define TRACE_ZONE(name) trace_zone_t TRACE_CAT(trace_zone_, __LINE__)(name)
+
+struct trace_event_t
+{
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+struct trace_ring_t
+{
+    char name[32];
+    uint32_t tid;
+    bool in_use;
+    std::atomic<uint64_t> head;
+    trace_event_t events[TRACE_RING];
+};
+
+struct
+{
+    std::mutex lock;
+    // never freed, threads may still write to them at exit
+    trace_ring_t *rings[TRACE_THREADS];
+    uint32_t ring_count = 0;
+    const char *path = "trace.json";
+    // --trace, dump to path on exit
+    bool dump_on_exit = false;
+} trace;
+
+// hands the ring back when the thread exits, so short lived workers reuse rings
+struct trace_local_t
+{
+    trace_ring_t *ring = nullptr;
+
+    ~trace_local_t()
+    {
+        if (!ring)
+            return;
+        std::lock_guard<std::mutex> guard(trace.lock);
+        ring->in_use = false;
+    }
+};
+thread_local trace_local_t trace_local;
+
+uint64_t trace_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+trace_ring_t *trace_ring()
+{
+    if (trace_local.ring)
+        return trace_local.ring;
+
+    std::lock_guard<std::mutex> guard(trace.lock);
+    for (uint32_t t = 0; t < trace.ring_count; t++)
+    {
+        trace_ring_t *ring = trace.rings[t];
+        if (!ring->in_use)
+        {
+            ring->in_use = true;
+            return trace_local.ring = ring;
+        }
+    }
+    if (trace.ring_count == TRACE_THREADS)
+        return nullptr;
+    trace_ring_t *ring = new trace_ring_t;
+    ring->tid = trace.ring_count;
+    snprintf(ring->name, sizeof(ring->name), "thread %u", ring->tid);
+    ring->in_use = true;
+    ring->head = 0;
+    trace.rings[trace.ring_count++] = ring;
+    return trace_local.ring = ring;
+}
+
+void trace_thread_name(const char *name)
+{
+    if (trace_ring_t *ring = trace_ring())
+        snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
+
+// name has to outlive the trace, string literals only
+void trace_record(const char *name, uint64_t begin, uint64_t end)
+{
+    trace_ring_t *ring = trace_ring();
+    if (!ring)
+        return;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->events[head % TRACE_RING] = {name, begin, end};
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+struct trace_zone_t
+{
+    const char *name;
+    uint64_t begin;
+    // optional running total the duration is added to
+    std::atomic<uint64_t> *sum;
+    uint64_t allocs;
+
+    trace_zone_t(const char *name, std::atomic<uint64_t> *sum = nullptr) : name(name), begin(trace_now()), sum(sum), allocs(alloc_thread_count) {}
+    ~trace_zone_t()
+    {
+        uint64_t end = trace_now();
+        trace_record(name, begin, end);
+        if (sum)
+            sum->fetch_add(end - begin, std::memory_order_relaxed);
+        if (alloc_thread_count != allocs)
+            alloc_zone_add(name, alloc_thread_count - allocs);
+    }
+};
+
+// zones still being written by other threads while this runs can come out torn
+bool trace_dump(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        printf("TRACE: couldnt create %s\n", path);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(trace.lock);
+    size_t written = 0;
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (uint32_t t = 0; t < trace.ring_count; t++)
+    {
+        trace_ring_t *ring = trace.rings[t];
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", ring->tid ? ",\n" : "", ring->tid, ring->name);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > TRACE_RING ? head - TRACE_RING : 0;
+        for (uint64_t i = first; i < head; i++)
+        {
+            const trace_event_t &e = ring->events[i % TRACE_RING];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", e.name, ring->tid, e.begin / 1000.0, (e.end - e.begin) / 1000.0);
+            written++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    printf("TRACE: wrote %zu zones to %s\n", written, path);
+    return true;
+}
+
+// F9 dumps the last few seconds of every thread
+void trace_hotkey()
+{
+    if (IsKeyPressed(KEY_F9))
+        trace_dump(trace.path);
+}
+
+// perf overlay, F3 toggles it. sim stages add their time through TRACE_STAGE,
+// render numbers are counted by the draw helpers
+#define HUD_WINDOW 240
+// rlgl defaults, a batch is flushed when either runs out
+#define HUD_BATCH_DRAWS 256
+#define HUD_BATCH_QUADS 8192
+#define TRACE_STAGE(name, stage) trace_zone_t TRACE_CAT(trace_zone_, __LINE__)(name, &hud.stage_ns[stage])
+
+enum _STAGE
+{
+    STAGE_SIM,
+    STAGE_ENEMIES,
+    STAGE_ASTEROIDS,
+    STAGE_PROJECTILES,
+    STAGE_COLLISIONS,
+    STAGE_INPUT,
+    STAGE_ANIMATIONS,
+    STAGE_SPAWNER,
+    STAGE_DRAW,
+    STAGES
+};
+
+const char *stage_names[STAGES] = {"sim", "enemies", "asteroids", "projectiles", "collisions", "input", "animations", "spawner", "draw"};
+
+struct render_stats_t
+{
+    uint32_t quads;
+    uint32_t draw_calls;
+    uint32_t flushes;
+    uint32_t texture_switches;
+    uint32_t texture;
+    uint32_t batch_draws;
+    uint32_t batch_quads;
+};
+
+struct
+{
+    bool visible = false;
+    float frame_ms[HUD_WINDOW];
+    size_t frames = 0;
+    // accumulated during the frame, smoothed per frame
+    // stages can run on the job workers
+    std::atomic<uint64_t> stage_ns[STAGES];
+    float stage_ms[STAGES];
+    render_stats_t render;
+    render_stats_t last_render;
+    float hud_ms = 0;
+} hud;
+
+// a region of an atlas page. transparent borders are trimmed away when
+// packing, width and height stay the untrimmed size so hitboxes and layout
+// don't change, offset is where the trimmed rect sits inside that size
+struct sprite_t
+{
+    Texture2D *page;
+    Rectangle src;
+    Vector2 offset;
+    int width;
+    int height;
+};
+
+struct asteroid_t
+{
+    sprite_t *sprite;
+    Vector2 pos;
+    Vector2 velocity;
+    int hp;
+};
+
+struct projectile_t
+{
+    sprite_t *sprite;
+    Vector2 pos;
+    Vector2 direction;
+    float speed;
+    int damage;
+};
+
+struct ship_t
+{
+    sprite_t *sprite;
+    Vector2 pos;
+    Vector2 prev_pos;
+    float speed;
+    int hp;
+    int max_hp;
+    int shield;
+    int max_shield;
+    float shooting_cooldown;
+    float last_shot;
+    std::vector<projectile_t> weaponarsenal;
+    float shieldrecovertime;
+    uint8_t weapon;
+    uint8_t player;
+    float powerup_cd;
+    // powerups raise max_hp and max_shield, every session starts from these
+    int base_hp;
+    int base_shield;
+    // damage and shield recovery bookkeeping, reset every session
+    float base_speed;
+    double last_hit;
+    double shield_hit;
+    int last_shield;
+    int last_hp;
+};
+
+struct enemy_t
+{
+    sprite_t *sprite;
+    Vector2 pos;
+    Vector2 prev_pos;
+    // the route is generated from the wave seed, see enemy_waypoint()
+    Vector2 path_origin;
+    uint64_t path_seed;
+    uint32_t pathpos;
+    float speed;
+    int hp;
+    float shooting_cooldown;
+    float last_shot;
+};
+
+enum _CLIP
+{
+    CLIP_EXPLOSION,
+    CLIP_EXPLOSION2,
+    CLIP_BIG_BOOM,
+    CLIP_BOOST,
+    CLIP_POWUP_LIFE,
+    CLIP_POWUP_SHIELD,
+    CLIP_POWUP_WEAPON,
+    CLIPS
+};
+
+// immutable animation definition, built once in init_types()
+struct clip_t
+{
+    sprite_t *sprite;
+    std::vector<Rectangle> frames;
+    float frame_rate;
+    // size of one frame
+    float width;
+    float height;
+    _ANIM style;
+};
+
+// a playing clip. the frame follows from the age, so instances only carry
+// what differs between them
+struct animation_t
+{
+    Vector2 position;
+    Vector2 prev_position;
+    float start;
+    uint16_t clip;
+    uint16_t frame;
+};
+
+struct handle_t
+{
+    uint32_t index;
+    uint32_t generation;
+};
+
+// maps stable handles onto a densely packed array. removing swaps the last
+// element into the hole, the slot of a removed element gets a new generation
+// so old handles to it stop resolving
+struct slotmap_t
+{
+    std::vector<uint32_t> dense_slot;
+    std::vector<uint32_t> slot_dense;
+    std::vector<uint32_t> generation;
+    std::vector<uint32_t> free_slots;
+
+    handle_t insert(uint32_t dense)
+    {
+        uint32_t slot;
+        if (!free_slots.empty())
+        {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        else
+        {
+            slot = slot_dense.size();
+            slot_dense.push_back(0);
+            generation.push_back(0);
+        }
+        slot_dense[slot] = dense;
+        dense_slot.push_back(slot);
+        return {slot, generation[slot]};
+    }
+
+    // the element at dense index last has been moved to dense
+    void remove(uint32_t dense, uint32_t last)
+    {
+        uint32_t slot = dense_slot[dense];
+        generation[slot]++;
+        free_slots.push_back(slot);
+
+        dense_slot[dense] = dense_slot[last];
+        slot_dense[dense_slot[dense]] = dense;
+        dense_slot.pop_back();
+    }
+
+    handle_t handle(uint32_t dense) const
+    {
+        uint32_t slot = dense_slot[dense];
+        return {slot, generation[slot]};
+    }
+
+    bool valid(handle_t handle) const
+    {
+        return handle.index < generation.size() && generation[handle.index] == handle.generation;
+    }
+
+    void clear()
+    {
+        for (uint32_t slot : dense_slot)
+        {
+            generation[slot]++;
+            free_slots.push_back(slot);
+        }
+        dense_slot.clear();
+    }
+
+    void reserve(size_t n)
+    {
+        dense_slot.reserve(n);
+        slot_dense.reserve(n);
+        generation.reserve(n);
+        free_slots.reserve(n);
+    }
+};
+
+// returned by a full pool, never resolves
+const handle_t handle_none = {UINT32_MAX, 0};
+
+// entity container with O(1) removal, iteration order is not stable.
+// pools never grow past what was reserved, push_back drops the item when
+// full so a running session never touches the heap
+template <typename T>
+struct pool_t
+{
+    std::vector<T> items;
+    slotmap_t slots;
+
+    size_t size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+    bool full() const { return items.size() == items.capacity(); }
+    T &operator[](size_t i) { return items[i]; }
+    const T &operator[](size_t i) const { return items[i]; }
+    T *begin() { return items.data(); }
+    T *end() { return items.data() + items.size(); }
+    const T *begin() const { return items.data(); }
+    const T *end() const { return items.data() + items.size(); }
+
+    handle_t push_back(const T &item)
+    {
+        if (full())
+            return handle_none;
+        items.push_back(item);
+        return slots.insert(items.size() - 1);
+    }
+
+    // swap-remove, the caller must not advance its index after this
+    void remove(size_t i)
+    {
+        size_t last = items.size() - 1;
+        if (i != last)
+            items[i] = items[last];
+        items.pop_back();
+        slots.remove(i, last);
+    }
+
+    handle_t handle(size_t i) const { return slots.handle(i); }
+
+    T *get(handle_t handle)
+    {
+        if (!slots.valid(handle))
+            return nullptr;
+        return &items[slots.slot_dense[handle.index]];
+    }
+
+    void clear()
+    {
+        items.clear();
+        slots.clear();
+    }
+
+    void reserve(size_t n)
+    {
+        items.reserve(n);
+        slots.reserve(n);
+    }
+};
+
+template <typename T>
+void swap_remove(std::vector<T> &vec, size_t i)
+{
+    vec[i] = vec.back();
+    vec.pop_back();
+}
+
+// asteroids and projectiles come in large numbers, so they are stored as
+// structure of arrays. the update kernels only stream through the float
+// columns, texture and the rest of the cold data sit in their own arrays.
+// like pool_t they are fixed size after reserve()
+struct asteroid_pool_t
+{
+    std::vector<float> x, y;
+    std::vector<float> vx, vy;
+    std::vector<float> prev_x, prev_y;
+
+    std::vector<sprite_t *> sprite;
+    std::vector<int> hp;
+    slotmap_t slots;
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+    bool full() const { return x.size() == x.capacity(); }
+    Vector2 pos(size_t i) const { return {x[i], y[i]}; }
+    Vector2 prev_pos(size_t i) const { return {prev_x[i], prev_y[i]}; }
+
+    handle_t push_back(const asteroid_t &asteroid)
+    {
+        if (full())
+            return handle_none;
+        x.push_back(asteroid.pos.x);
+        y.push_back(asteroid.pos.y);
+        vx.push_back(asteroid.velocity.x);
+        vy.push_back(asteroid.velocity.y);
+        prev_x.push_back(asteroid.pos.x);
+        prev_y.push_back(asteroid.pos.y);
+        sprite.push_back(asteroid.sprite);
+        hp.push_back(asteroid.hp);
+        return slots.insert(x.size() - 1);
+    }
+
+    void remove(size_t i)
+    {
+        size_t last = x.size() - 1;
+        swap_remove(x, i);
+        swap_remove(y, i);
+        swap_remove(vx, i);
+        swap_remove(vy, i);
+        swap_remove(prev_x, i);
+        swap_remove(prev_y, i);
+        swap_remove(sprite, i);
+        swap_remove(hp, i);
+        slots.remove(i, last);
+    }
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        vx.clear();
+        vy.clear();
+        prev_x.clear();
+        prev_y.clear();
+        sprite.clear();
+        hp.clear();
+        slots.clear();
+    }
+
+    void reserve(size_t n)
+    {
+        x.reserve(n);
+        y.reserve(n);
+        vx.reserve(n);
+        vy.reserve(n);
+        prev_x.reserve(n);
+        prev_y.reserve(n);
+        sprite.reserve(n);
+        hp.reserve(n);
+        slots.reserve(n);
+    }
+};
+
+struct projectile_pool_t
+{
+    std::vector<float> x, y;
+    std::vector<float> dx, dy;
+    std::vector<float> speed;
+    std::vector<float> prev_x, prev_y;
+
+    std::vector<sprite_t *> sprite;
+    std::vector<int> damage;
+    slotmap_t slots;
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+    bool full() const { return x.size() == x.capacity(); }
+    Vector2 pos(size_t i) const { return {x[i], y[i]}; }
+    Vector2 prev_pos(size_t i) const { return {prev_x[i], prev_y[i]}; }
+
+    handle_t push_back(const projectile_t &projectile)
+    {
+        if (full())
+            return handle_none;
+        x.push_back(projectile.pos.x);
+        y.push_back(projectile.pos.y);
+        dx.push_back(projectile.direction.x);
+        dy.push_back(projectile.direction.y);
+        speed.push_back(projectile.speed);
+        prev_x.push_back(projectile.pos.x);
+        prev_y.push_back(projectile.pos.y);
+        sprite.push_back(projectile.sprite);
+        damage.push_back(projectile.damage);
+        return slots.insert(x.size() - 1);
+    }
+
+    void remove(size_t i)
+    {
+        size_t last = x.size() - 1;
+        swap_remove(x, i);
+        swap_remove(y, i);
+        swap_remove(dx, i);
+        swap_remove(dy, i);
+        swap_remove(speed, i);
+        swap_remove(prev_x, i);
+        swap_remove(prev_y, i);
+        swap_remove(sprite, i);
+        swap_remove(damage, i);
+        slots.remove(i, last);
+    }
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        dx.clear();
+        dy.clear();
+        speed.clear();
+        prev_x.clear();
+        prev_y.clear();
+        sprite.clear();
+        damage.clear();
+        slots.clear();
+    }
+
+    void reserve(size_t n)
+    {
+        x.reserve(n);
+        y.reserve(n);
+        dx.reserve(n);
+        dy.reserve(n);
+        speed.reserve(n);
+        prev_x.reserve(n);
+        prev_y.reserve(n);
+        sprite.reserve(n);
+        damage.reserve(n);
+        slots.reserve(n);
+    }
+};
+
+// batch kinematics, plain loops over restrict pointers so the compiler
+// vectorizes them (SSE/AVX on x86, NEON on arm) without intrinsics
+void integrate(float *__restrict pos, const float *__restrict velocity, float dt, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        pos[i] += velocity[i] * dt;
+}
+
+void integrate_accelerated(float *__restrict x, float *__restrict y, const float *__restrict dx, const float *__restrict dy, float *__restrict speed, float acceleration, float dt, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        float step = dt * speed[i];
+        x[i] += step * dx[i];
+        y[i] += step * dy[i];
+        speed[i] += dt * acceleration;
+    }
+}
+
+// uniform grid broadphase, entities are bucketed by their hitbox center with a
+// counting sort. positions outside the grid are clamped into the border cells,
+// so nothing is ever missed, it just gets more candidates out there
+struct grid_t
+{
+    float x0, y0;
+    float cell;
+    int cols, rows;
+    float max_radius;
+    std::vector<uint32_t> cell_start;
+    std::vector<uint32_t> cell_fill;
+    std::vector<uint32_t> item_cell;
+    std::vector<uint32_t> items;
+
+    void init(float x, float y, float width, float height, float cellsize)
+    {
+        x0 = x;
+        y0 = y;
+        cell = cellsize;
+        cols = (int)ceilf(width / cellsize);
+        rows = (int)ceilf(height / cellsize);
+        max_radius = 0;
+        cell_start.assign(cols * rows + 1, 0);
+        cell_fill.assign(cols * rows, 0);
+    }
+
+    int col_of(float x) const
+    {
+        int c = (int)floorf((x - x0) / cell);
+        return c < 0 ? 0 : (c >= cols ? cols - 1 : c);
+    }
+
+    void reserve(size_t n)
+    {
+        item_cell.reserve(n);
+        items.reserve(n);
+    }
+
+    int row_of(float y) const
+    {
+        int r = (int)floorf((y - y0) / cell);
+        return r < 0 ? 0 : (r >= rows ? rows - 1 : r);
+    }
+
+    // center(i) returns the hitbox center of entity i, radius is the largest hitbox radius among them
+    template <typename F>
+    void build(size_t n, float radius, F center)
+    {
+        max_radius = radius;
+        std::fill(cell_start.begin(), cell_start.end(), 0);
+        item_cell.resize(n);
+        items.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            Vector2 c = center(i);
+            uint32_t idx = row_of(c.y) * cols + col_of(c.x);
+            item_cell[i] = idx;
+            cell_start[idx + 1]++;
+        }
+        for (size_t c = 0; c < cell_fill.size(); c++)
+        {
+            cell_start[c + 1] += cell_start[c];
+            cell_fill[c] = cell_start[c];
+        }
+        for (size_t i = 0; i < n; i++)
+            items[cell_fill[item_cell[i]]++] = i;
+    }
+
+    // calls visit(i) for every entity whose hitbox could touch a circle at p, stops when visit returns true
+    template <typename F>
+    void query(Vector2 p, float radius, F visit) const
+    {
+        float reach = radius + max_radius;
+        int cx0 = col_of(p.x - reach), cx1 = col_of(p.x + reach);
+        int cy0 = row_of(p.y - reach), cy1 = row_of(p.y + reach);
+        for (int cy = cy0; cy <= cy1; cy++)
+        {
+            for (int cx = cx0; cx <= cx1; cx++)
+            {
+                int c = cy * cols + cx;
+                for (uint32_t k = cell_start[c]; k < cell_start[c + 1]; k++)
+                    if (visit(items[k]))
+                        return;
+            }
+        }
+    }
+};
+
+// small seedable generator (splitmix64). every subsystem draws from its own
+// stream, so an extra draw in one place doesn't shift the rest of the session
+struct rng_t
+{
+    uint64_t state;
+
+    void seed(uint64_t s)
+    {
+        state = s;
+    }
+
+    uint32_t next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return (uint32_t)((z ^ (z >> 31)) >> 32);
+    }
+
+    // 0 .. n-1
+    int range(int n)
+    {
+        return (int)(next() % (uint32_t)n);
+    }
+};
+
+// snapshots for multi_send(). positions are quantized to 16 bits over
+// [SNAP_QUANT_MIN, SNAP_QUANT_MIN + SNAP_QUANT_RANGE), 1/16 px at the default range.
+// entities are identified by their pool slot and generation and listed in slot
+// order, so the encoder can walk the acked snapshot next to the current one and
+// only send position deltas for entities the peer already knows
+#define SNAP_QUANT_MIN -2048.0f
+#define SNAP_QUANT_RANGE 4096.0f
+#define SNAP_HISTORY 32
+#define SNAP_NONE 0xFFFFFFFFu
+
+struct snap_entity_t
+{
+    uint32_t slot;
+    uint32_t generation;
+    uint16_t x;
+    uint16_t y;
+};
+
+struct snapshot_t
+{
+    uint32_t tick;
+    uint8_t inputs;
+    uint8_t state;
+    int32_t hp;
+    int32_t shield;
+    uint16_t x;
+    uint16_t y;
+    std::vector<snap_entity_t> entities[CONTAINERS];
+};
+
+// one repeat-wrapped full screen quad per layer, back to front
+struct bg_layer_t
+{
+    const char *path;
+    // decoded size, 0 keeps the source size. has to end up a power of two,
+    // GLES2 and WebGL only repeat-wrap those
+    int size;
+    // texels are drawn scale screen pixels wide
+    float scale;
+    // screen pixels per second
+    float speed;
+    Color tint;
+    Texture2D texture;
+    // in texels, wrapped to the texture height
+    float scroll;
+};
+
+struct game
+{
+    Vector2 ship_startpos;
+    Vector2 screencenter;
+    double gametime = 0;
+    float delta = 0;
+    // fixed simulation step, render interpolates between the last two steps
+    int sim_hz = 120;
+    float sim_dt = 1.0f / 120;
+    double sim_accumulator = 0;
+    uint8_t inputs = 0;
+    uint8_t last_inputs = 0;
+    // session seed, fixed by --seed or a replay, otherwise picked per session
+    uint64_t seed = 1;
+    bool seed_fixed = false;
+    struct
+    {
+        rng_t spawn;
+        rng_t enemy;
+        rng_t event;
+    } rng;
+    uint32_t highscore = 0;
+    bool headless = false;
+    // --autopilot, inputs come from autopilot_inputs()
+    bool autopilot = false;
+    // the enemy the autopilot lines up under, held across frames
+    handle_t autopilot_target = handle_none;
+    bool pause = false;
+    bool exit = false;
+    int textsize;
+    int window_height;
+    int window_width;
+
+    struct
+    {
+        int enemy_spawner;
+        double asteroid_spawntimer;
+        double enemy_spawntimer;
+        int asteroid_spawns;
+        double enemy_spawnspeed;
+        float event_timer;
+    } spawner;
+
+    struct
+    {
+        grid_t asteroids;
+        grid_t enemies;
+        std::vector<uint8_t> dead_projectiles;
+        std::vector<uint8_t> dead_asteroids;
+        std::vector<uint8_t> dead_enemies;
+    } broadphase;
+    asteroid_pool_t asteroids;
+    projectile_pool_t projectiles;
+    projectile_pool_t enemy_projectiles;
+    pool_t<enemy_t> enemies;
+    pool_t<animation_t> explosions;
+    pool_t<animation_t> powerups;
+
+    // snapshots sent by multi_send(), indexed by tick % SNAP_HISTORY
+    struct
+    {
+        snapshot_t history[SNAP_HISTORY];
+        uint32_t tick = 0;
+        uint32_t acked = SNAP_NONE;
+        // in the frame arena, valid until the end of the frame
+        uint8_t *buffer = nullptr;
+        size_t bytes = 0;
+        bool reserved = false;
+    } net;
+
+    struct
+    {
+        sprite_t ship_tex;
+        sprite_t ufo_tex;
+        sprite_t torpedo_tex;
+        sprite_t explosion_tex;
+        sprite_t explosion2_tex;
+        sprite_t big_boom_tex;
+        sprite_t shield_tex;
+        sprite_t boost_text;
+        sprite_t orb_red;
+        sprite_t ui_bar_f;
+        sprite_t ui_bar_b;
+        sprite_t ui_bar_red;
+        sprite_t ui_bar_blue;
+        sprite_t powup_life_tex;
+        sprite_t powup_shield_tex;
+        sprite_t powup_weapon_tex;
+
+        std::vector<sprite_t> asteroid_textures;
+        std::vector<Texture2D> pages;
+    } textures;
+
+    clip_t clips[CLIPS];
+
+    std::vector<bg_layer_t> background = {
+        // 1024 already, drawn texel per pixel and behind everything else
+        {"assets/background/space1.png", 0, 1, 20, WHITE},
+        {"assets/background/spr_stars01.png", 1024, 2, 50, WHITE},
+        {"assets/background/spr_stars02.png", 2048, 2, 100, WHITE},
+    };
+
+    struct
+    {
+        Music bg_music;
+        Music opening;
+    } sound;
+
+    struct
+    {
+        ship_t ship;
+        projectile_t weapon1;
+        projectile_t enemy_attack;
+        enemy_t enemy;
+        animation_t boost;
+    } var;
+
+} game;
+
+// baked asset pack. decoded and resized RGBA8 pixels keyed by source path,
+// source mtime and target size, so later launches skip PNG decoding and
+// ImageResize. layout: bake_header_t, count bake_entry_t, pixel blobs
+#define BAKE_MAGIC 0x4B414246
+#define BAKE_VERSION 1
+#define BAKE_PATH "assets/baked.pack"
+
+struct bake_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct bake_entry_t
+{
+    char path[128];
+    int64_t mtime;
+    int32_t target_width;
+    int32_t target_height;
+    int32_t width;
+    int32_t height;
+    uint64_t offset;
+};
+
+struct bake_item_t
+{
+    bake_entry_t entry;
+    const uint8_t *pixels;
+    Image owned;
+};
+
+struct bake_cache_t
+{
+    uint8_t *data = nullptr;
+    size_t size = 0;
+    bool valid = false;
+    bool dirty = false;
+    bool rebuild = false;
+    std::vector<bake_item_t> used;
+    std::mutex lock;
+} bake_cache;
+
+void bake_open()
+{
+    if (bake_cache.rebuild)
+        return;
+#ifdef _WIN32
+    FILE *file = fopen(BAKE_PATH, "rb");
+    if (!file)
+        return;
+    fseek(file, 0, SEEK_END);
+    bake_cache.size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    bake_cache.data = (uint8_t *)malloc(bake_cache.size);
+    if (fread(bake_cache.data, 1, bake_cache.size, file) != bake_cache.size)
+    {
+        free(bake_cache.data);
+        bake_cache.data = nullptr;
+    }
+    fclose(file);
+#else
+    int fd = open(BAKE_PATH, O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            bake_cache.data = (uint8_t *)map;
+            bake_cache.size = st.st_size;
+        }
+    }
+    close(fd);
+#endif
+    if (!bake_cache.data)
+        return;
+
+    auto header = (const bake_header_t *)bake_cache.data;
+    bake_cache.valid = bake_cache.size >= sizeof(bake_header_t) && header->magic == BAKE_MAGIC && header->version == BAKE_VERSION &&
+                       bake_cache.size >= sizeof(bake_header_t) + header->count * sizeof(bake_entry_t);
+    if (!bake_cache.valid)
+        printf("BAKE: ignoring stale or broken %s\n", BAKE_PATH);
+}
+
+void bake_close()
+{
+    if (!bake_cache.data)
+        return;
+#ifdef _WIN32
+    free(bake_cache.data);
+#else
+    munmap(bake_cache.data, bake_cache.size);
+#endif
+    bake_cache.data = nullptr;
+    bake_cache.size = 0;
+    bake_cache.valid = false;
+}
+
+const bake_entry_t *bake_find(const char *path, int64_t mtime, int width, int height)
+{
+    if (!bake_cache.valid)
+        return nullptr;
+    auto header = (const bake_header_t *)bake_cache.data;
+    auto entries = (const bake_entry_t *)(bake_cache.data + sizeof(bake_header_t));
+    for (uint32_t i = 0; i < header->count; i++)
+    {
+        auto &e = entries[i];
+        if (e.mtime == mtime && e.target_width == width && e.target_height == height && !strncmp(e.path, path, sizeof(e.path)) &&
+            e.offset + (uint64_t)e.width * e.height * 4 <= bake_cache.size)
+            return &e;
+    }
+    return nullptr;
+}
+
+// LoadImage + ImageResize through the bake cache, width/height 0 keeps the source size.
+// the result is always RGBA8 and owned by the caller. safe to call from worker threads
+Image load_image_baked(const char *path, int width, int height)
+{
+    TRACE_ZONE("load_image_baked");
+    struct stat st;
+    int64_t mtime = stat(path, &st) == 0 ? (int64_t)st.st_mtime : 0;
+
+    bake_item_t item = {};
+    strncpy(item.entry.path, path, sizeof(item.entry.path) - 1);
+    item.entry.mtime = mtime;
+    item.entry.target_width = width;
+    item.entry.target_height = height;
+
+    const bake_entry_t *hit = bake_find(path, mtime, width, height);
+    if (hit)
+    {
+        Image image = {RL_MALLOC((size_t)hit->width * hit->height * 4), hit->width, hit->height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+        memcpy(image.data, bake_cache.data + hit->offset, (size_t)hit->width * hit->height * 4);
+        item.entry = *hit;
+        item.pixels = bake_cache.data + hit->offset;
+        std::lock_guard<std::mutex> guard(bake_cache.lock);
+        bake_cache.used.push_back(item);
+        return image;
+    }
+
+    Image image = LoadImage(path);
+    if (image.data == nullptr)
+        return image;
+    if (width > 0 && height > 0)
+        ImageResize(&image, width, height);
+    ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+    item.entry.width = image.width;
+    item.entry.height = image.height;
+    item.owned = ImageCopy(image);
+    item.pixels = (const uint8_t *)item.owned.data;
+    std::lock_guard<std::mutex> guard(bake_cache.lock);
+    bake_cache.used.push_back(item);
+    bake_cache.dirty = true;
+    return image;
+}
+
+// rewrites the pack with everything loaded this run when anything was missing or stale
+void bake_write()
+{
+    TRACE_ZONE("bake_write");
+    if (bake_cache.dirty)
+    {
+        const char *tmp_path = BAKE_PATH ".tmp";
+        FILE *file = fopen(tmp_path, "wb");
+        if (file)
+        {
+            bake_header_t header = {BAKE_MAGIC, BAKE_VERSION, (uint32_t)bake_cache.used.size(), 0};
+            uint64_t offset = sizeof(header) + bake_cache.used.size() * sizeof(bake_entry_t);
+            for (auto &item : bake_cache.used)
+            {
+                item.entry.offset = offset;
+                offset += (uint64_t)item.entry.width * item.entry.height * 4;
+            }
+
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+            for (auto &item : bake_cache.used)
+                ok = ok && fwrite(&item.entry, sizeof(item.entry), 1, file) == 1;
+            for (auto &item : bake_cache.used)
+                ok = ok && fwrite(item.pixels, (size_t)item.entry.width * item.entry.height * 4, 1, file) == 1;
+            ok = fclose(file) == 0 && ok;
+
+#ifdef _WIN32
+            remove(BAKE_PATH);
+#endif
+            if (ok && rename(tmp_path, BAKE_PATH) == 0)
+                printf("BAKE: wrote %zu images to %s\n", bake_cache.used.size(), BAKE_PATH);
+            else
+                remove(tmp_path);
+        }
+    }
+
+    for (auto &item : bake_cache.used)
+        UnloadImage(item.owned);
+    bake_cache.used.clear();
+    bake_cache.dirty = false;
+    bake_close();
+}
+
+// headless runs have no GL context, so textures only carry their size for hitboxes
+Texture2D load_texture_from_image(Image image)
+{
+    if (game.headless)
+        return (Texture2D){0, image.width, image.height, 1, image.format};
+    return LoadTextureFromImage(image);
+}
+
+Texture2D load_texture(const char *path)
+{
+    Image image = load_image_baked(path, 0, 0);
+    Texture2D texture = load_texture_from_image(image);
+    UnloadImage(image);
+    return texture;
+}
+
+// sound effects. play_sound() only counts requests, audio_flush() turns each
+// sound requested during the frame into a single voice command, louder the
+// more requests it coalesced. the audio thread starts the voices, enforces
+// the voice caps and mixes everything into one AudioStream
+#define AUDIO_RATE 44100
+#define AUDIO_VOICES 12
+#define AUDIO_QUEUE 64
+
+enum _SFX
+{
+    SFX_EXPLOSION,
+    SFX_GUN,
+    SFX_CLICK,
+    SFX_SELECT,
+    SFXS
+};
+
+struct sfx_t
+{
+    std::vector<float> samples;
+    float volume;
+    int max_voices;
+    // a voice can only be stolen by a sound of at least its priority
+    int priority;
+};
+
+struct voice_t
+{
+    uint8_t sfx;
+    bool active;
+    float gain;
+    uint32_t pos;
+};
+
+struct voice_cmd_t
+{
+    uint8_t sfx;
+    float gain;
+};
+
+// single producer single consumer ring, the producer only writes tail, the consumer only head
+template <typename T, size_t N>
+struct spsc_queue_t
+{
+    T items[N];
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+
+    bool push(const T &item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N)
+            return false;
+        items[t % N] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        item = items[h % N];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+struct
+{
+    AudioStream stream;
+    bool running = false;
+    sfx_t sfx[SFXS];
+    // main thread only
+    uint16_t pending[SFXS];
+    spsc_queue_t<voice_cmd_t, AUDIO_QUEUE> queue;
+    // audio thread only
+    voice_t voices[AUDIO_VOICES];
+
+    // counters, written by the audio thread except coalesced
+    struct
+    {
+        std::atomic<uint32_t> voices{0};
+        std::atomic<uint32_t> started{0};
+        std::atomic<uint32_t> stolen{0};
+        std::atomic<uint32_t> dropped{0};
+        std::atomic<uint32_t> coalesced{0};
+        std::atomic<uint32_t> mix_ns{0};
+        std::atomic<uint32_t> mix_peak_ns{0};
+    } stats;
+} audio;
+
+void play_sound(_SFX sfx)
+{
+    if (!audio.running)
+        return;
+    audio.pending[sfx]++;
+}
+
+// once per rendered frame
+void audio_flush()
+{
+    for (int i = 0; i < SFXS; i++)
+    {
+        uint16_t count = audio.pending[i];
+        if (count == 0)
+            continue;
+        audio.pending[i] = 0;
+        audio.stats.coalesced += count - 1;
+        voice_cmd_t cmd = {(uint8_t)i, audio.sfx[i].volume * fminf(sqrtf(count), 2.0f)};
+        if (!audio.queue.push(cmd))
+            audio.stats.dropped++;
+    }
+}
+
+// audio thread. takes a free voice, else steals the most advanced voice of the
+// same sound once its cap is reached, else the most advanced voice of the
+// lowest priority that isn't above ours
+void audio_start_voice(const voice_cmd_t &cmd)
+{
+    const sfx_t &sfx = audio.sfx[cmd.sfx];
+    if (sfx.samples.empty())
+        return;
+
+    int same = 0;
+    voice_t *free_voice = nullptr;
+    voice_t *same_victim = nullptr;
+    voice_t *victim = nullptr;
+    for (auto &v : audio.voices)
+    {
+        if (!v.active)
+        {
+            free_voice = free_voice ? free_voice : &v;
+            continue;
+        }
+        if (v.sfx == cmd.sfx)
+        {
+            same++;
+            if (!same_victim || v.pos > same_victim->pos)
+                same_victim = &v;
+        }
+        int p = audio.sfx[v.sfx].priority;
+        if (p <= sfx.priority && (!victim || p < audio.sfx[victim->sfx].priority || (p == audio.sfx[victim->sfx].priority && v.pos > victim->pos)))
+            victim = &v;
+    }
+
+    voice_t *voice = free_voice;
+    if (same >= sfx.max_voices)
+        voice = same_victim;
+    else if (!voice)
+        voice = victim;
+    if (!voice)
+    {
+        audio.stats.dropped++;
+        return;
+    }
+    if (voice->active)
+        audio.stats.stolen++;
+    *voice = {cmd.sfx, true, cmd.gain, 0};
+    audio.stats.started++;
+}
+
+// mixing kernels, vectorized by the compiler like integrate(). the clamp is
+// written with compares because fminf/fmaxf only vectorize with -ffast-math
+void mix_add(float *__restrict out, const float *__restrict in, float gain, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] += in[i] * gain;
+}
+
+void mix_clamp(float *__restrict out, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        float v = out[i] < -1.0f ? -1.0f : out[i];
+        out[i] = v > 1.0f ? 1.0f : v;
+    }
+}
+
+void audio_callback(void *buffer, unsigned int frames)
+{
+    TRACE_ZONE("audio_callback");
+    uint64_t begin = trace_now();
+    float *out = (float *)buffer;
+
+    voice_cmd_t cmd;
+    while (audio.queue.pop(cmd))
+        audio_start_voice(cmd);
+
+    memset(out, 0, frames * sizeof(float));
+    uint32_t active = 0;
+    for (auto &v : audio.voices)
+    {
+        if (!v.active)
+            continue;
+        const std::vector<float> &samples = audio.sfx[v.sfx].samples;
+        size_t n = std::min((size_t)frames, samples.size() - v.pos);
+        mix_add(out, samples.data() + v.pos, v.gain, n);
+        v.pos += n;
+        if (v.pos >= samples.size())
+            v.active = false;
+        else
+            active++;
+    }
+    mix_clamp(out, frames);
+
+    uint32_t ns = trace_now() - begin;
+    audio.stats.voices = active;
+    audio.stats.mix_ns = ns;
+    if (ns > audio.stats.mix_peak_ns)
+        audio.stats.mix_peak_ns = ns;
+}
+
+void audio_load(_SFX id, const char *path, float volume, int max_voices, int priority)
+{
+    sfx_t &sfx = audio.sfx[id];
+    sfx.volume = volume;
+    sfx.max_voices = max_voices;
+    sfx.priority = priority;
+
+    Wave wave = LoadWave(path);
+    if (wave.data == nullptr)
+        return;
+    // float mono at the mixer rate, so mixing is a plain multiply add
+    WaveFormat(&wave, AUDIO_RATE, 32, 1);
+    sfx.samples.assign((float *)wave.data, (float *)wave.data + wave.frameCount);
+    UnloadWave(wave);
+}
+
+// sorted, so the asteroid frames always end up in the same order
+void list_images_in_dir(std::vector<std::string> &vec, const char *path)
+{
+    auto dir = opendir(path);
+    if (!dir)
+    {
+        printf("couldnt find assets");
+        return;
+    }
+    size_t first = vec.size();
+    dirent *entry = readdir(dir);
+    while (entry != nullptr)
+    {
+        if (strstr(entry->d_name, ".png") != nullptr)
+        {
+            std::string text = std::string(path) + "/" + entry->d_name;
+            printf("TEXTPATH : %s \n", text.c_str());
+            vec.push_back(text);
+        }
+        entry = readdir(dir);
+    }
+    closedir(dir);
+    std::sort(vec.begin() + first, vec.end());
+}
+
+// runs fn(0..count-1) spread over all cores, fn has to be thread safe
+template <typename F>
+void parallel_jobs(size_t count, F fn)
+{
+    size_t workers = std::thread::hardware_concurrency();
+    if (workers == 0)
+        workers = 1;
+    if (workers > count)
+        workers = count;
+
+    std::atomic<size_t> next(0);
+    auto work = [&]()
+    {
+        for (size_t i = next++; i < count; i = next++)
+            fn(i);
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < workers; t++)
+        threads.emplace_back([&]()
+        {
+            trace_thread_name("worker");
+            work();
+        });
+    work();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+// work stealing job system for the sim. every thread owns a deque, it pushes
+// and pops its own jobs at the bottom and steals from the top of the others
+// when it runs dry. a thread waiting for its jobs keeps running jobs meanwhile,
+// so jobs can fork more jobs. nothing here allocates, a full deque runs the
+// job inline. --jobs N sets the thread count including the sim thread
+#define JOB_THREADS 64
+#define JOB_QUEUE 256
+#define JOB_GRAPH_NODES 16
+#define JOB_GRAPH_EDGES 8
+// take attempts before a thread with nothing to do goes to sleep
+#define JOB_SPIN 64
+
+struct job_t
+{
+    void (*run)(const void *ctx, size_t begin, size_t end);
+    const void *ctx;
+    size_t begin;
+    size_t end;
+    // decremented when the job is done
+    std::atomic<uint32_t> *pending;
+};
+
+struct job_queue_t
+{
+    std::mutex lock;
+    job_t jobs[JOB_QUEUE];
+    uint32_t top = 0;
+    uint32_t bottom = 0;
+
+    bool push(const job_t &job)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (bottom - top == JOB_QUEUE)
+            return false;
+        jobs[bottom++ % JOB_QUEUE] = job;
+        return true;
+    }
+
+    bool pop(job_t &job)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (bottom == top)
+            return false;
+        job = jobs[--bottom % JOB_QUEUE];
+        return true;
+    }
+
+    bool steal(job_t &job)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (bottom == top)
+            return false;
+        job = jobs[top++ % JOB_QUEUE];
+        return true;
+    }
+};
+
+void jobs_stop();
+
+struct job_system_t
+{
+    int threads = 1;
+    job_queue_t queues[JOB_THREADS];
+    std::thread workers[JOB_THREADS];
+    std::atomic<bool> running{false};
+    std::atomic<int> queued{0};
+    std::mutex sleep_lock;
+    std::condition_variable sleep;
+
+    ~job_system_t() { jobs_stop(); }
+} jobs;
+
+// index of the calling thread's deque, the sim thread is 0
+thread_local int job_thread = 0;
+
+void jobs_wake()
+{
+    if (jobs.threads == 1)
+        return;
+    {
+        std::lock_guard<std::mutex> guard(jobs.sleep_lock);
+    }
+    jobs.sleep.notify_all();
+}
+
+void job_run(const job_t &job)
+{
+    job.run(job.ctx, job.begin, job.end);
+    // the last one out wakes whoever parked in jobs_wait() for it
+    if (job.pending->fetch_sub(1, std::memory_order_release) == 1)
+        jobs_wake();
+}
 
-struct asteroid_t
+void job_push(const job_t &job)
 {
-    Texture2D *texture;
-    Vector2 pos;
-    int hp;
-};
+    if (!jobs.queues[job_thread].push(job))
+    {
+        job_run(job);
+        return;
+    }
+    jobs.queued++;
+}
 
-struct projectile_t
+bool job_take(job_t &job)
 {
-    Texture2D *texture;
-    Vector2 pos;
-    Vector2 direction;
-    float speed;
-    int damage;
+    if (jobs.queued.load(std::memory_order_relaxed) == 0)
+        return false;
+    bool found = jobs.queues[job_thread].pop(job);
+    for (int i = 1; !found && i < jobs.threads; i++)
+        found = jobs.queues[(job_thread + i) % jobs.threads].steal(job);
+    if (found)
+        jobs.queued--;
+    return found;
+}
+
+// helps out until pending drops to zero. when there is nothing left to take
+// it spins a little like the workers, then sleeps until the last job is done
+// or more work is queued
+void jobs_wait(std::atomic<uint32_t> &pending)
+{
+    job_t job;
+    int spin = 0;
+    while (pending.load(std::memory_order_acquire))
+    {
+        if (job_take(job))
+        {
+            job_run(job);
+            spin = 0;
+        }
+        else if (spin++ < JOB_SPIN)
+            std::this_thread::yield();
+        else
+        {
+            std::unique_lock<std::mutex> lock(jobs.sleep_lock);
+            jobs.sleep.wait(lock, [&]()
+            {
+                return !pending.load(std::memory_order_acquire) || jobs.queued > 0;
+            });
+            spin = 0;
+        }
+    }
+}
+
+void job_worker(int thread)
+{
+    job_thread = thread;
+    alloc_game_thread = true;
+    trace_thread_name("job worker");
+    job_t job;
+    while (jobs.running)
+    {
+        // spin a little before sleeping, sim stages come in quick bursts
+        bool found = false;
+        for (int spin = 0; spin < JOB_SPIN && !found; spin++)
+        {
+            found = job_take(job);
+            if (!found)
+                std::this_thread::yield();
+        }
+        if (found)
+        {
+            job_run(job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(jobs.sleep_lock);
+        jobs.sleep.wait(lock, []()
+        {
+            return jobs.queued > 0 || !jobs.running;
+        });
+    }
+}
+
+void jobs_start(int threads)
+{
+    if (threads < 1)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    jobs.threads = std::min(threads, JOB_THREADS);
+    jobs.running = true;
+    for (int t = 1; t < jobs.threads; t++)
+        jobs.workers[t] = std::thread(job_worker, t);
+    printf("JOBS: %d threads\n", jobs.threads);
+}
+
+void jobs_stop()
+{
+    if (!jobs.running)
+        return;
+    jobs.running = false;
+    jobs_wake();
+    for (int t = 1; t < jobs.threads; t++)
+        jobs.workers[t].join();
+    jobs.threads = 1;
+}
+
+template <typename F>
+void job_range(const void *ctx, size_t begin, size_t end)
+{
+    (*(const F *)ctx)(begin, end);
+}
+
+// fn(begin, end) over [0, count) in chunks of at least grain, the caller takes
+// the first chunk. fn must only touch its own range, then the result is the
+// same for any thread count
+template <typename F>
+void parallel_for(size_t count, size_t grain, const F &fn)
+{
+    size_t chunks = (count + grain - 1) / grain;
+    if (chunks > (size_t)jobs.threads * 4)
+        chunks = jobs.threads * 4;
+    if (jobs.threads == 1 || chunks <= 1)
+    {
+        fn(0, count);
+        return;
+    }
+
+    size_t step = (count + chunks - 1) / chunks;
+    std::atomic<uint32_t> pending(0);
+    for (size_t begin = step; begin < count; begin += step)
+    {
+        pending++;
+        job_push({job_range<F>, &fn, begin, std::min(begin + step, count), &pending});
+    }
+    jobs_wake();
+    fn(0, step);
+    jobs_wait(pending);
+}
+
+struct job_graph_t;
+
+static_assert(JOB_GRAPH_NODES <= 256, "job_node_t keeps its successors in uint8_t");
+
+struct job_node_t
+{
+    void (*run)(const void *ctx, size_t begin, size_t end);
+    const void *ctx;
+    job_graph_t *graph;
+    std::atomic<uint32_t> waiting;
+    uint32_t deps;
+    uint8_t next[JOB_GRAPH_EDGES];
+    uint8_t next_count;
 };
 
-struct ship_t
+template <typename F>
+void job_call(const void *ctx, size_t, size_t)
 {
-    Texture2D *texture;
-    Vector2 pos;
-    float speed;
-    int hp;
-    int max_hp;
-    int shield;
-    int max_shield;
-    float shooting_cooldown;
-    float last_shot;
-    std::vector<projectile_t> weaponarsenal;
-    float shieldrecovertime;
-    uint8_t weapon;
-    uint8_t player;
-    float powerup_cd;
+    (*(const F *)ctx)();
+}
+
+void job_node_run(const void *ctx, size_t, size_t);
+
+// stages and what they wait for. a node starts once all nodes it runs after
+// are done, independent nodes run side by side. run() returns when all are done
+struct job_graph_t
+{
+    job_node_t nodes[JOB_GRAPH_NODES];
+    int count = 0;
+    std::atomic<uint32_t> pending{0};
+
+    // fn() is kept by reference, it has to outlive run()
+    template <typename F>
+    int add(F &fn)
+    {
+        assert(count < JOB_GRAPH_NODES);
+        job_node_t &node = nodes[count];
+        node.run = job_call<F>;
+        node.ctx = &fn;
+        node.graph = this;
+        node.deps = 0;
+        node.next_count = 0;
+        return count++;
+    }
+
+    void after(int node, int dep)
+    {
+        assert(node < count && dep < count && nodes[dep].next_count < JOB_GRAPH_EDGES);
+        nodes[dep].next[nodes[dep].next_count++] = node;
+        nodes[node].deps++;
+    }
+
+    void push(int node)
+    {
+        job_push({job_node_run, &nodes[node], 0, 0, &pending});
+    }
+
+    void run()
+    {
+        pending = count;
+        for (int i = 0; i < count; i++)
+            nodes[i].waiting = nodes[i].deps;
+        // the deque pops the last push first, so the caller starts on node 0
+        for (int i = count; i-- > 0;)
+            if (!nodes[i].deps)
+                push(i);
+        jobs_wake();
+        jobs_wait(pending);
+    }
 };
 
-struct enemy_t
+void job_node_run(const void *ctx, size_t, size_t)
 {
+    job_node_t &node = *(job_node_t *)ctx;
+    node.run(node.ctx, 0, 0);
+    bool pushed = false;
+    for (int i = 0; i < node.next_count; i++)
+    {
+        if (node.graph->nodes[node.next[i]].waiting.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            node.graph->push(node.next[i]);
+            pushed = true;
+        }
+    }
+    if (pushed)
+        jobs_wake();
+}
+
+struct image_job_t
+{
+    std::string path;
+    int width;
+    int height;
+    sprite_t *sprite;
     Texture2D *texture;
-    Vector2 pos;
-    std::vector<Vector2> *path;
-    int pathpos;
-    float speed;
-    int hp;
-    float shooting_cooldown;
-    float last_shot;
+    Image image;
 };
 
-struct animation_t
+struct atlas_entry_t
 {
-    Texture2D *texture;
-    Rectangle framerec;
-    Vector2 position;
-    int frames;
-    int cols;
-    int rows;
-    float framespeed;
-    int currentframe;
-    float framescounter;
-    _ANIM style;
+    sprite_t *sprite;
+    Image image;
+    int page;
+    int x;
+    int y;
 };
 
-struct game
+// trims the transparent border of every image, packs them into as few
+// page_size pages as possible with a shelf packer and uploads the pages.
+// an image that still doesn't fit a page is scaled down until it does.
+// takes ownership of the images
+void atlas_build(std::vector<atlas_entry_t> &entries, std::vector<Texture2D> &pages, int page_size)
 {
-    Vector2 ship_startpos;
-    Vector2 screencenter;
-    double gametime = 0;
-    float delta = 0;
-    uint32_t highscore = 0;
-    bool pause = false;
-    bool exit = false;
-    int bg_scollspeed;
-    float bg_scrollpos;
-    int textsize;
-    int window_height;
-    int window_width;
+    TRACE_ZONE("atlas_build");
+    const int padding = 1;
+    const int limit = page_size - 2 * padding;
 
-    std::vector<Vector2> collisions;
-    std::vector<asteroid_t> asteroids;
-    std::vector<projectile_t> projectiles;
-    std::vector<projectile_t> enemy_projectiles;
-    std::vector<enemy_t> enemies;
-    std::vector<animation_t> explosions;
-    std::vector<animation_t> powerups;
+    parallel_jobs(entries.size(), [&](size_t i)
+    {
+        auto &e = entries[i];
+        e.sprite->width = e.image.width;
+        e.sprite->height = e.image.height;
+        e.sprite->offset = {0, 0};
+        if (e.image.data == nullptr)
+            return;
 
-    struct
+        ImageFormat(&e.image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        Rectangle trim = GetImageAlphaBorder(e.image, 0.0f);
+        if (trim.width < e.image.width || trim.height < e.image.height)
+        {
+            Image trimmed = ImageFromImage(e.image, trim);
+            UnloadImage(e.image);
+            e.image = trimmed;
+            e.sprite->offset = {trim.x, trim.y};
+        }
+        if (e.image.width > limit || e.image.height > limit)
+        {
+            float scale = fminf((float)limit / e.image.width, (float)limit / e.image.height);
+            printf("ATLAS: %dx%d sprite doesnt fit a %d page, scaled by %.3f\n", e.image.width, e.image.height, page_size, scale);
+            ImageResize(&e.image, std::max(1, (int)(e.image.width * scale)), std::max(1, (int)(e.image.height * scale)));
+            e.sprite->width = std::max(1, (int)(e.sprite->width * scale));
+            e.sprite->height = std::max(1, (int)(e.sprite->height * scale));
+            e.sprite->offset = {floorf(e.sprite->offset.x * scale), floorf(e.sprite->offset.y * scale)};
+        }
+    });
+
+    // tallest first keeps the shelves tight
+    std::vector<atlas_entry_t *> order;
+    for (auto &e : entries)
+        order.push_back(&e);
+    std::stable_sort(order.begin(), order.end(), [](const atlas_entry_t *a, const atlas_entry_t *b)
     {
-        Texture2D bg_tex;
-        Texture2D ship_tex;
-        Texture2D ufo_tex;
-        Texture2D torpedo_tex;
-        Texture2D explosion_tex;
-        Texture2D explosion2_tex;
-        Texture2D big_boom_tex;
-        Texture2D shield_tex;
-        Texture2D boost_text;
-        Texture2D orb_red;
-        Texture2D ui_bar_f;
-        Texture2D ui_bar_b;
-        Texture2D ui_bar_red;
-        Texture2D ui_bar_blue;
-        Texture2D powup_life_tex;
-        Texture2D powup_shield_tex;
-        Texture2D powup_weapon_tex;
-
-        std::vector<Texture2D> asteroid_textures;
-    } textures;
+        return a->image.height > b->image.height;
+    });
 
-    struct
+    std::vector<int> used_height(1, 0);
+    int x = padding, y = padding, shelf = 0;
+    for (auto e : order)
     {
-        animation_t explosion;
-        animation_t explosion2;
-        animation_t big_boom;
-        animation_t boost;
-        animation_t powup_life;
-        animation_t powup_shield;
-        animation_t powup_weapon;
-    } animations;
+        if (x + e->image.width + padding > page_size)
+        {
+            x = padding;
+            y += shelf + padding;
+            shelf = 0;
+        }
+        if (y + e->image.height + padding > page_size)
+        {
+            used_height.push_back(0);
+            x = padding;
+            y = padding;
+            shelf = 0;
+        }
+        e->page = used_height.size() - 1;
+        e->x = x;
+        e->y = y;
+        x += e->image.width + padding;
+        if (e->image.height > shelf)
+            shelf = e->image.height;
+        if (y + shelf + padding > used_height.back())
+            used_height.back() = y + shelf + padding;
+    }
 
-    struct
+    pages.resize(used_height.size());
+    for (size_t p = 0; p < pages.size(); p++)
     {
-        Music bg_music;
-        Music opening;
-        Sound explosion_sound;
-        Sound gunloop_sound;
-        Sound click;
-        Sound select;
-    } sound;
+        Image page = GenImageColor(page_size, used_height[p], BLANK);
+        for (auto &e : entries)
+        {
+            if (e.page != (int)p || e.image.data == nullptr)
+                continue;
+            for (int row = 0; row < e.image.height; row++)
+                memcpy((uint8_t *)page.data + ((size_t)(e.y + row) * page_size + e.x) * 4, (uint8_t *)e.image.data + (size_t)row * e.image.width * 4, (size_t)e.image.width * 4);
+        }
+        pages[p] = load_texture_from_image(page);
+        UnloadImage(page);
+    }
 
-    struct
+    for (auto &e : entries)
     {
-        ship_t ship;
-        projectile_t weapon1;
-        projectile_t enemy_attack;
-        enemy_t enemy;
-        std::vector<Vector2> enemy_path;
-    } var;
+        e.sprite->page = &pages[e.page];
+        e.sprite->src = {(float)e.x, (float)e.y, (float)e.image.width, (float)e.image.height};
+        UnloadImage(e.image);
+    }
+    printf("ATLAS: %zu sprites on %zu pages\n", entries.size(), pages.size());
+}
 
-} game;
+// sim events. the sim is the only producer, gameplay, scoring, FX and audio
+// each read the ring at their own pace through their own event_reader_t. the
+// producer never waits: a reader that falls a whole ring behind skips ahead
+// and counts what it lost. every slot is a tiny seqlock so a reader notices
+// when the slot it copies gets overwritten
+#define EVENT_RING 8192
 
-void load_textures_from_dir(std::vector<Texture2D> &vec, const char *path)
+enum _EVENT
 {
-    auto dir = opendir(path);
-    if (!dir)
+    // a shot hit something, pos is the point of impact
+    EVENT_HIT,
+    // a player shot destroyed an asteroid or an enemy, value is the score
+    EVENT_KILL,
+    // the ship collected a powerup
+    EVENT_PICKUP,
+    // the ship takes value damage
+    EVENT_DAMAGE,
+    // value entities of kind entered the field
+    EVENT_SPAWN,
+    EVENTS
+};
+
+struct event_t
+{
+    uint8_t type;
+    // _CONTAINER of the entity involved, CONTAINERS for powerups which
+    // aren't in one. they are told apart by clip
+    uint8_t kind;
+    uint16_t clip;
+    int32_t value;
+    Vector2 pos;
+};
+
+static_assert(sizeof(event_t) == 2 * sizeof(uint64_t), "event_t must fill an event slot");
+
+struct event_slot_t
+{
+    // sequence number + 1 of the event held, 0 while it is being written
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> words[2];
+};
+
+struct
+{
+    event_slot_t slots[EVENT_RING];
+    std::atomic<uint64_t> head{0};
+} events;
+
+// owned by one consumer, nothing else touches it
+struct event_reader_t
+{
+    uint64_t next = 0;
+    uint64_t lost = 0;
+};
+
+void event_publish(uint8_t type, uint8_t kind, int32_t value, Vector2 pos, uint16_t clip = 0)
+{
+    event_t e = {type, kind, clip, value, pos};
+    uint64_t words[2];
+    memcpy(words, &e, sizeof(e));
+
+    uint64_t n = events.head.load(std::memory_order_relaxed);
+    event_slot_t &slot = events.slots[n % EVENT_RING];
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.words[0].store(words[0], std::memory_order_relaxed);
+    slot.words[1].store(words[1], std::memory_order_relaxed);
+    slot.seq.store(n + 1, std::memory_order_release);
+    events.head.store(n + 1, std::memory_order_release);
+}
+
+// only events published from now on
+void event_subscribe(event_reader_t &reader)
+{
+    reader.next = events.head.load(std::memory_order_acquire);
+}
+
+// false once the reader has caught up
+bool event_next(event_reader_t &reader, event_t &e)
+{
+    for (;;)
     {
-        printf("couldnt find assets");
+        uint64_t head = events.head.load(std::memory_order_acquire);
+        if (reader.next == head)
+            return false;
+        if (head - reader.next > EVENT_RING)
+        {
+            reader.lost += head - EVENT_RING - reader.next;
+            reader.next = head - EVENT_RING;
+        }
+
+        event_slot_t &slot = events.slots[reader.next % EVENT_RING];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        uint64_t words[2] = {slot.words[0].load(std::memory_order_relaxed), slot.words[1].load(std::memory_order_relaxed)};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        bool valid = seq == reader.next + 1 && slot.seq.load(std::memory_order_relaxed) == seq;
+        reader.next++;
+        if (!valid)
+        {
+            // overwritten while we copied it
+            reader.lost++;
+            continue;
+        }
+        memcpy(&e, words, sizeof(e));
+        return true;
+    }
+}
+
+event_reader_t gameplay_events;
+event_reader_t score_events;
+event_reader_t fx_events;
+event_reader_t audio_events;
+
+// load governor. once per sim frame it weighs the smoothed frame time and sim
+// step time against their budgets and moves the load level one step up or
+// down. higher levels shed work in the order it matters least to play: first
+// explosions and background layers, then asteroid spawns, enemy spawns last.
+// shots, enemy shots, powerups and the ship are never shed. the level is
+// sampled once per sim frame like the inputs and recorded with them, so a
+// replay sheds exactly what the session did
+#define GOVERNOR_LEVELS 6
+// share of its tick a sim step may take, the rest belongs to the render thread
+#define GOVERNOR_SIM_SHARE 0.5f
+#define GOVERNOR_RAISE 1.0f
+#define GOVERNOR_LOWER 0.6f
+// seconds between two raises, lowering waits four times as long
+#define GOVERNOR_HOLD 0.5
+#define GOVERNOR_MIN_ASTEROIDS 64
+
+struct
+{
+    bool enabled = true;
+    float budget_ms = 1000.0f / 60;
+    // smoothed by the render thread
+    std::atomic<float> frame_ms{0};
+    // sim thread only from here
+    float step_ms = 0;
+    float load = 0;
+    uint64_t changed = 0;
+    uint8_t level = 0;
+    uint32_t explosions_seen = 0;
+    uint32_t enemies_seen = 0;
+    // shed this session
+    uint32_t asteroids_denied = 0;
+    uint32_t explosions_thinned = 0;
+    uint32_t enemies_denied = 0;
+} governor;
+
+void governor_reset()
+{
+    governor.frame_ms = 0;
+    governor.step_ms = 0;
+    governor.load = 0;
+    governor.changed = trace_now();
+    governor.level = 0;
+    governor.explosions_seen = 0;
+    governor.enemies_seen = 0;
+    governor.asteroids_denied = 0;
+    governor.explosions_thinned = 0;
+    governor.enemies_denied = 0;
+}
+
+// sim thread, once per sim frame before the inputs are taken. not during a
+// replay, which brings its own levels
+void governor_update()
+{
+    float sim_budget_ms = game.sim_dt * 1000 * GOVERNOR_SIM_SHARE;
+    governor.load = std::max(governor.frame_ms.load(std::memory_order_relaxed) / governor.budget_ms, governor.step_ms / sim_budget_ms);
+    if (!governor.enabled)
         return;
+
+    uint64_t now = trace_now();
+    double since = (now - governor.changed) / 1e9;
+    if (governor.load > GOVERNOR_RAISE && governor.level < GOVERNOR_LEVELS && since > GOVERNOR_HOLD)
+    {
+        governor.level++;
+        governor.changed = now;
     }
-    dirent *entry = readdir(dir);
-    char *text = (char *)malloc(1024);
-    while (entry != nullptr)
+    else if (governor.load < GOVERNOR_LOWER && governor.level > 0 && since > GOVERNOR_HOLD * 4)
     {
-        if (strstr(entry->d_name, ".png") != nullptr)
-        {
-            memset(text, 0, 1024);
-            strcpy(text, path);
-            strcat(text, "/");
-            strcat(text, entry->d_name);
-            printf("TEXTPATH : %.*s \n", 1024, text);
-            vec.push_back(LoadTexture(text));
-        }
-        entry = readdir(dir);
+        governor.level--;
+        governor.changed = now;
     }
+}
+
+// how many of wanted asteroids may spawn, from level 2 the live count is
+// capped, halving with every level
+int governor_admit_asteroids(int wanted)
+{
+    if (governor.level < 2)
+        return wanted;
+    int cap = std::max(GOVERNOR_MIN_ASTEROIDS, MAX_ASTEROIDS >> (governor.level - 1));
+    int admitted = std::max(0, std::min(wanted, cap - (int)game.asteroids.size()));
+    governor.asteroids_denied += wanted - admitted;
+    return admitted;
+}
+
+// from level 1 only every 2nd, 4th, at most 8th explosion is shown
+bool governor_admit_explosion()
+{
+    uint32_t stride = 1u << std::min<int>(governor.level, 3);
+    if (governor.explosions_seen++ % stride == 0)
+        return true;
+    governor.explosions_thinned++;
+    return false;
+}
+
+// enemies wait longer between spawns from level 4
+float governor_enemy_scale()
+{
+    return governor.level >= 4 ? governor.level - 2 : 1;
+}
+
+// the same rate for level timelines, which bring their own spawn times: from
+// level 4 only every 2nd, 3rd, 4th enemy event spawns
+bool governor_admit_enemy()
+{
+    uint32_t stride = governor_enemy_scale();
+    if (governor.enemies_seen++ % stride == 0)
+        return true;
+    governor.enemies_denied++;
+    return false;
+}
 
-    free(entry);
-    free(text);
+// background layers worth drawing at a level, the nearest star layer goes first
+size_t governor_background_layers(int level)
+{
+    return level >= 3 ? 1 : level >= 1 ? 2 : SIZE_MAX;
 }
 
 void playerdamage(ship_t &player, int damage)
 {
-    static double last_hit = 0;
     // invincibility time
 
     if (damage < 0 && player.hp < player.max_hp)
@@ -206,10 +2477,10 @@ void playerdamage(ship_t &player, int damage)
         return;
     }
 
-    if (game.gametime - last_hit > player.shieldrecovertime / 2)
+    if (game.gametime - player.last_hit > player.shieldrecovertime / 2)
         return;
 
-    last_hit = game.gametime;
+    player.last_hit = game.gametime;
     player.shield -= damage;
     if (player.shield < 0)
     {
@@ -220,219 +2491,376 @@ void playerdamage(ship_t &player, int damage)
 
 void shieldrecover(ship_t &player)
 {
-    static double last_hit = game.gametime;
-    static int last_shield = player.shield;
-    static int last_hp = player.hp;
-
     if (player.shield == player.max_shield)
         return;
 
-    if (last_shield > player.shield || last_hp > player.hp)
+    if (player.last_shield > player.shield || player.last_hp > player.hp)
     {
-        last_shield = player.shield;
-        last_hp = player.hp;
-        last_hit = game.gametime;
+        player.last_shield = player.shield;
+        player.last_hp = player.hp;
+        player.shield_hit = game.gametime;
         return;
     }
-    else if (game.gametime - last_hit > player.shieldrecovertime)
+    else if (game.gametime - player.shield_hit > player.shieldrecovertime)
     {
         player.shield += 10;
         if (player.shield > player.max_shield)
             player.shield = player.max_shield;
-        last_shield = player.shield;
+        player.last_shield = player.shield;
     }
 }
 
-void asteroids_update(std::vector<asteroid_t> &asteroids)
+void asteroids_update(asteroid_pool_t &asteroids)
 {
-    auto height = GetScreenHeight();
-    for (int i = 0; i < asteroids.size(); i++)
+    TRACE_STAGE("asteroids_update", STAGE_ASTEROIDS);
+    auto height = game.window_height;
+    parallel_for(asteroids.size(), 512, [&](size_t begin, size_t end)
     {
-        auto &asteroid = asteroids[i];
-        asteroid.pos.y += game.delta * 100;
-        // out of vision
-        if (asteroid.pos.y > height)
-            asteroids.erase(std::next(asteroids.begin(), i));
-    }
+        integrate(asteroids.x.data() + begin, asteroids.vx.data() + begin, game.delta, end - begin);
+        integrate(asteroids.y.data() + begin, asteroids.vy.data() + begin, game.delta, end - begin);
+    });
+
+    // out of vision, going backwards so swapped in elements were already checked
+    for (size_t i = asteroids.size(); i-- > 0;)
+        if (asteroids.y[i] > height)
+            asteroids.remove(i);
 }
 
-void asteroids_spawn(std::vector<asteroid_t> &asteroids, Texture2D *texture, int num)
+void asteroids_spawn(asteroid_pool_t &asteroids, sprite_t *sprite, int num)
 {
-    auto height = GetScreenHeight();
-    auto width = GetScreenWidth();
+    auto height = game.window_height;
+    auto width = game.window_width;
     for (int i = 0; i < num; i++)
     {
-        asteroids.push_back((asteroid_t){texture, {(float)(rand() % (2 * width) - width), (float)(rand() % (height)-1.5f * height)}});
+        Vector2 pos = {(float)(game.rng.spawn.range(2 * width) - width), (float)(game.rng.spawn.range(height) - 1.5f * height)};
+        asteroids.push_back((asteroid_t){sprite, pos, {0, 100}});
     }
 }
 
-void projectiles_update(std::vector<projectile_t> &projectiles)
+void projectiles_update(projectile_pool_t &projectiles)
 {
-    auto height = GetScreenHeight();
-    auto width = GetScreenWidth();
+    TRACE_STAGE("projectiles_update", STAGE_PROJECTILES);
+    auto height = game.window_height;
+    auto width = game.window_width;
 
-    for (int i = 0; i < projectiles.size(); i++)
+    // boooost!!!
+    parallel_for(projectiles.size(), 512, [&](size_t begin, size_t end)
     {
-        auto &projectile = projectiles[i];
-        projectile.pos.x += (game.delta * projectile.speed) * projectile.direction.x;
-        projectile.pos.y += (game.delta * projectile.speed) * projectile.direction.y;
-        // boooost!!!
-        projectile.speed += game.delta * 1000;
-        // out of Vision
-        if (projectile.pos.y > height + 10 || projectile.pos.y < -10 || projectile.pos.x < -10 || projectile.pos.x > width + 10)
-        {
-            projectiles.erase(std::next(projectiles.begin(), i));
-        }
-    }
+        integrate_accelerated(projectiles.x.data() + begin, projectiles.y.data() + begin, projectiles.dx.data() + begin, projectiles.dy.data() + begin, projectiles.speed.data() + begin, 1000, game.delta, end - begin);
+    });
+
+    // out of Vision
+    for (size_t i = projectiles.size(); i-- > 0;)
+        if (projectiles.y[i] > height + 10 || projectiles.y[i] < -10 || projectiles.x[i] < -10 || projectiles.x[i] > width + 10)
+            projectiles.remove(i);
 }
 
-void collision_handler(std::vector<projectile_t> &projectiles, std::vector<asteroid_t> &asteroids, std::vector<enemy_t> &enemies, ship_t &player, std::vector<projectile_t> &enemy_projectiles, std::vector<animation_t> &powerups)
+template <typename P>
+void remove_marked(P &pool, std::vector<uint8_t> &dead)
 {
-    int damage = 0;
-    // DrawCircleV(player.pos,player.texture->height/2,BLUE);
+    // descending, so the element swapped into a hole is always one we already kept
+    for (size_t i = pool.size(); i-- > 0;)
+        if (dead[i])
+            pool.remove(i);
+}
+
+// only finds what collided and removes it, what follows from a collision is
+// up to the event consumers
+void collision_handler(projectile_pool_t &projectiles, asteroid_pool_t &asteroids, pool_t<enemy_t> &enemies, ship_t &player, projectile_pool_t &enemy_projectiles, pool_t<animation_t> &powerups)
+{
+    TRACE_STAGE("collision_handler", STAGE_COLLISIONS);
+    auto &bp = game.broadphase;
+    // DrawCircleV(player.pos,player.sprite->height/2,BLUE);
+
+    float asteroid_radius = 0;
+    for (auto sprite : asteroids.sprite)
+        asteroid_radius = fmaxf(asteroid_radius, fmaxf(sprite->width, sprite->height) / 2);
+    bp.asteroids.build(asteroids.size(), asteroid_radius, [&](size_t j) -> Vector2
+    {
+        return {asteroids.x[j] + asteroids.sprite[j]->width / 2, asteroids.y[j] + asteroids.sprite[j]->height / 2};
+    });
+
+    float enemy_radius = 0;
+    for (auto &e : enemies)
+        enemy_radius = fmaxf(enemy_radius, fmaxf(e.sprite->width, e.sprite->height) / 2);
+    bp.enemies.build(enemies.size(), enemy_radius, [&](size_t j) -> Vector2
+    {
+        return {enemies[j].pos.x + enemies[j].sprite->width / 2, enemies[j].pos.y + enemies[j].sprite->height / 2};
+    });
+
+    bp.dead_projectiles.assign(projectiles.size(), 0);
+    bp.dead_asteroids.assign(asteroids.size(), 0);
+    bp.dead_enemies.assign(enemies.size(), 0);
 
     // Iterate trough Projectiles
-    for (int i = 0; i < projectiles.size(); i++)
+    for (size_t i = 0; i < projectiles.size(); i++)
     {
-        Vector2 projectile_hitbox = {projectiles[i].pos.x + projectiles[i].texture->width / 2, projectiles[i].pos.y};
+        Vector2 projectile_hitbox = {projectiles.x[i] + projectiles.sprite[i]->width / 2, projectiles.y[i]};
         // DrawCircleV(projectile_hitbox,5,BLUE);
+        bool hit = false;
 
         // collision between asteroid and projectile
-        for (int j = 0; j < asteroids.size(); j++)
+        bp.asteroids.query(projectile_hitbox, 0, [&](uint32_t j)
         {
-            Vector2 asteroids_hitbox = {asteroids[j].pos.x + asteroids[j].texture->width / 2, asteroids[j].pos.y + asteroids[j].texture->height / 2};
-            // DrawCircleV(asteroids_hitbox,asteroids[j].texture->height/2,RED);
-            if (CheckCollisionPointCircle(projectile_hitbox, asteroids_hitbox, asteroids[j].texture->height / 2))
+            if (bp.dead_asteroids[j])
+                return false;
+            Vector2 asteroids_hitbox = {asteroids.x[j] + asteroids.sprite[j]->width / 2, asteroids.y[j] + asteroids.sprite[j]->height / 2};
+            // DrawCircleV(asteroids_hitbox,asteroids.sprite[j]->height/2,RED);
+            if (!CheckCollisionPointCircle(projectile_hitbox, asteroids_hitbox, asteroids.sprite[j]->height / 2))
+                return false;
+            event_publish(EVENT_HIT, ASTEROIDS, 0, projectile_hitbox);
+            event_publish(EVENT_KILL, ASTEROIDS, 100, projectile_hitbox);
+            bp.dead_asteroids[j] = 1;
+            return hit = true;
+        });
+
+        // collision between enemy and projectile
+        if (!hit)
+            bp.enemies.query(projectile_hitbox, 0, [&](uint32_t j)
             {
-                game.collisions.push_back(projectile_hitbox);
-                projectiles.erase(std::next(projectiles.begin(), i));
-                asteroids.erase(std::next(asteroids.begin(), j));
-                game.highscore += 100;
-                goto LOOP_END;
-            }
+                if (bp.dead_enemies[j])
+                    return false;
+                Vector2 enemies_hitbox = {enemies[j].pos.x + enemies[j].sprite->width / 2, enemies[j].pos.y + enemies[j].sprite->height / 2};
+                // DrawCircleV(enemies_hitbox,enemies[j].sprite->height/2,ORANGE);
+                if (!CheckCollisionPointCircle(projectile_hitbox, enemies_hitbox, enemies[j].sprite->height / 2))
+                    return false;
+                event_publish(EVENT_HIT, ENEMIES, 0, projectile_hitbox);
+                event_publish(EVENT_KILL, ENEMIES, 250, projectile_hitbox);
+                bp.dead_enemies[j] = 1;
+                return hit = true;
+            });
+
+        bp.dead_projectiles[i] = hit;
+    }
+
+    // check if player is hit
+    float player_radius = player.sprite->height / 2;
+    bp.asteroids.query(player.pos, player_radius, [&](uint32_t i)
+    {
+        if (bp.dead_asteroids[i])
+            return false;
+        Vector2 asteroids_hitbox = {asteroids.x[i] + asteroids.sprite[i]->width / 2, asteroids.y[i] + asteroids.sprite[i]->height / 2};
+        if (CheckCollisionCircles(asteroids_hitbox, asteroids.sprite[i]->width / 2, player.pos, player_radius))
+        {
+            event_publish(EVENT_DAMAGE, ASTEROIDS, 500, asteroids_hitbox);
+            bp.dead_asteroids[i] = 1;
+        }
+        return false;
+    });
+    bp.enemies.query(player.pos, player_radius, [&](uint32_t i)
+    {
+        if (bp.dead_enemies[i])
+            return false;
+        Vector2 enemies_hitbox = {enemies[i].pos.x + enemies[i].sprite->width / 2, enemies[i].pos.y + enemies[i].sprite->height / 2};
+        if (CheckCollisionCircles(enemies_hitbox, enemies[i].sprite->width / 2, player.pos, player_radius))
+        {
+            event_publish(EVENT_DAMAGE, ENEMIES, 100, enemies_hitbox);
+            bp.dead_enemies[i] = 1;
         }
+        return false;
+    });
 
-        // collision between enemy and projectile
-        for (int j = 0; j < enemies.size(); j++)
+    remove_marked(projectiles, bp.dead_projectiles);
+    remove_marked(asteroids, bp.dead_asteroids);
+    remove_marked(enemies, bp.dead_enemies);
+
+    // enemy projectiles and powerups are only tested against the player, a
+    // single linear pass is already cheaper than bucketing them
+    for (size_t i = 0; i < enemy_projectiles.size();)
+    {
+        Vector2 enemies_hitbox = {enemy_projectiles.x[i] + enemy_projectiles.sprite[i]->width / 2, enemy_projectiles.y[i] + enemy_projectiles.sprite[i]->height / 2};
+        if (CheckCollisionCircles(enemies_hitbox, enemy_projectiles.sprite[i]->width / 2, player.pos, player.sprite->height / 2))
         {
-            Vector2 enemies_hitbox = {enemies[j].pos.x + enemies[j].texture->width / 2, enemies[j].pos.y + enemies[j].texture->height / 2};
-            // DrawCircleV(enemies_hitbox,enemies[j].texture->height/2,ORANGE);
-            if (CheckCollisionPointCircle(projectile_hitbox, enemies_hitbox, enemies[j].texture->height / 2))
-            {
-                game.collisions.push_back(projectile_hitbox);
-                projectiles.erase(std::next(projectiles.begin(), i));
-                enemies.erase(std::next(enemies.begin(), j));
-                game.highscore += 250;
-                goto LOOP_END;
-            }
+            event_publish(EVENT_HIT, ENEMYPROJECTILES, 0, enemies_hitbox);
+            event_publish(EVENT_DAMAGE, ENEMYPROJECTILES, enemy_projectiles.damage[i], enemies_hitbox);
+            enemy_projectiles.remove(i);
         }
-    LOOP_END:
+        else
+            i++;
     }
 
-    // check if player is hit
-    for (int i = 0; i < asteroids.size(); i++)
+    for (size_t i = 0; i < powerups.size();)
     {
-        Vector2 asteroids_hitbox = {asteroids[i].pos.x + asteroids[i].texture->width / 2, asteroids[i].pos.y + asteroids[i].texture->height / 2};
-        if (CheckCollisionCircles(asteroids_hitbox, asteroids[i].texture->width / 2, player.pos, player.texture->height / 2))
+        const clip_t &clip = game.clips[powerups[i].clip];
+        Vector2 powerup_hitbox = {powerups[i].position.x + clip.width / 2, powerups[i].position.y + clip.height / 2};
+        if (CheckCollisionCircles(powerup_hitbox, clip.width / 2, player.pos, player.sprite->height / 2))
         {
-            damage += 500;
-            asteroids.erase(std::next(asteroids.begin(), i));
+            event_publish(EVENT_PICKUP, CONTAINERS, 0, powerup_hitbox, powerups[i].clip);
+            powerups.remove(i);
         }
+        else
+            i++;
     }
-    for (int i = 0; i < enemies.size(); i++)
+}
+
+uint8_t read_inputs()
+{
+    uint8_t inputs = 0;
+    if (IsKeyDown(KEY_LEFT) || IsKeyDown(KEY_A))
+        inputs |= INPUT_LEFT;
+    if (IsKeyDown(KEY_RIGHT) || IsKeyDown(KEY_D))
+        inputs |= INPUT_RIGHT;
+    if (IsKeyDown(KEY_UP) || IsKeyDown(KEY_W))
+        inputs |= INPUT_UP;
+    if (IsKeyDown(KEY_DOWN) || IsKeyDown(KEY_S))
+        inputs |= INPUT_DOWN;
+    if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT))
+        inputs |= INPUT_BOOST;
+    if (IsKeyDown(KEY_SPACE))
+        inputs |= INPUT_SHOOT;
+    if (IsKeyDown(KEY_P))
+        inputs |= INPUT_PAUSE;
+    if (IsMouseButtonDown(MOUSE_BUTTON_LEFT))
+        inputs |= INPUT_MOUSE;
+    return inputs;
+}
+
+// autopilot for unattended runs. it scores every move by how close the ship
+// would get to asteroids, enemies and enemy shots a moment from now and takes
+// the safest one, lining up under a target while it is safe, and never stops
+// firing. besides its target it only reads sim state and returns a mask like
+// read_inputs(), so records and replays work as usual
+#define AUTOPILOT_LOOKAHEAD 0.8f
+#define AUTOPILOT_RANGE 80.0f
+// cost of a predicted overlap, outweighs any amount of near misses
+#define AUTOPILOT_HIT 1e6f
+
+uint8_t autopilot_inputs()
+{
+    const ship_t &ship = game.var.ship;
+    const uint8_t moves[] = {0, INPUT_LEFT, INPUT_RIGHT, INPUT_UP, INPUT_DOWN, INPUT_LEFT | INPUT_UP, INPUT_LEFT | INPUT_DOWN, INPUT_RIGHT | INPUT_UP, INPUT_RIGHT | INPUT_DOWN};
+    float radius = ship.sprite->height / 2;
+    float home_y = game.window_height * 0.8f;
+
+    // the enemy from last frame until it dies or passes the ship, then the
+    // lowest enemy, otherwise the closest asteroid above the ship
+    const enemy_t *target = game.enemies.get(game.autopilot_target);
+    if (!target || target->pos.y >= ship.pos.y)
     {
-        Vector2 enemies_hitbox = {enemies[i].pos.x + enemies[i].texture->width / 2, enemies[i].pos.y + enemies[i].texture->height / 2};
-        if (CheckCollisionCircles(enemies_hitbox, enemies[i].texture->width / 2, player.pos, player.texture->height / 2))
+        target = nullptr;
+        game.autopilot_target = handle_none;
+        for (size_t i = 0; i < game.enemies.size(); i++)
         {
-            damage += 100;
-            enemies.erase(std::next(enemies.begin(), i));
+            const enemy_t &e = game.enemies[i];
+            if (e.pos.y < ship.pos.y && (!target || e.pos.y > target->pos.y))
+            {
+                target = &e;
+                game.autopilot_target = game.enemies.handle(i);
+            }
         }
     }
-
-    for (int i = 0; i < enemy_projectiles.size(); i++)
+    float target_x = target ? target->pos.x + target->sprite->width / 2 : ship.pos.x;
+    if (!target)
     {
-        Vector2 enemies_hitbox = {enemy_projectiles[i].pos.x + enemy_projectiles[i].texture->width / 2, enemy_projectiles[i].pos.y + enemy_projectiles[i].texture->height / 2};
-        if (CheckCollisionCircles(enemies_hitbox, enemy_projectiles[i].texture->width / 2, player.pos, player.texture->height / 2))
+        float best = INFINITY;
+        for (size_t i = 0; i < game.asteroids.size(); i++)
         {
-            damage += enemy_projectiles[i].damage;
-            game.collisions.push_back(enemies_hitbox);
-            enemy_projectiles.erase(std::next(enemy_projectiles.begin(), i));
+            float cx = game.asteroids.x[i] + game.asteroids.sprite[i]->width / 2;
+            float dy = ship.pos.y - game.asteroids.y[i];
+            if (dy > 0 && game.asteroids.y[i] > 0 && dy + fabsf(cx - ship.pos.x) < best)
+            {
+                best = dy + fabsf(cx - ship.pos.x);
+                target_x = cx;
+            }
         }
     }
 
-    for (int i = 0; i < powerups.size(); i++)
+    uint8_t best_move = 0;
+    float best_cost = INFINITY;
+    for (uint8_t move : moves)
     {
-        Vector2 powerup_hitbox = {powerups[i].position.x + powerups[i].framerec.width / 2, powerups[i].position.y + powerups[i].framerec.height / 2};
-        if (CheckCollisionCircles(powerup_hitbox, powerups[i].framerec.width / 2, player.pos, player.texture->height / 2))
+        float cost = 0;
+        // four points along the lookahead, so a move can't pass through something
+        for (float k = 0.25f; k <= 1; k += 0.25f)
         {
-            if (powerups[i].texture == &game.textures.powup_life_tex)
-            {
-                damage -= 500;
-                game.var.ship.max_hp += 200;
-            }
-            else if (powerups[i].texture == &game.textures.powup_shield_tex)
+            float t = AUTOPILOT_LOOKAHEAD * k;
+            float step = ship.speed * t;
+            Vector2 p = ship.pos;
+            if (move & INPUT_LEFT)
+                p.x = fmaxf(p.x - step, ship.sprite->width / 2);
+            if (move & INPUT_RIGHT)
+                p.x = fminf(p.x + step, game.window_width - ship.sprite->width / 2);
+            if (move & INPUT_UP)
+                p.y = fmaxf(p.y - step, ship.sprite->height / 2);
+            if (move & INPUT_DOWN)
+                p.y = fminf(p.y + step, game.window_height - ship.sprite->height / 2);
+
+            auto threat = [&](float x, float y, float r)
             {
-                game.var.ship.max_shield += 1000;
-            }
-            else
+                float gap = sqrtf((x - p.x) * (x - p.x) + (y - p.y) * (y - p.y)) - r - radius;
+                if (gap < 0)
+                    cost += AUTOPILOT_HIT;
+                if (gap < AUTOPILOT_RANGE)
+                    cost += (AUTOPILOT_RANGE - gap) * (AUTOPILOT_RANGE - gap);
+            };
+            const asteroid_pool_t &a = game.asteroids;
+            for (size_t i = 0; i < a.size(); i++)
+                threat(a.x[i] + a.sprite[i]->width / 2 + a.vx[i] * t, a.y[i] + a.sprite[i]->height / 2 + a.vy[i] * t, a.sprite[i]->height / 2);
+            const projectile_pool_t &s = game.enemy_projectiles;
+            for (size_t i = 0; i < s.size(); i++)
+                threat(s.x[i] + s.sprite[i]->width / 2 + s.dx[i] * s.speed[i] * t, s.y[i] + s.sprite[i]->height / 2 + s.dy[i] * s.speed[i] * t, s.sprite[i]->width / 2);
+            for (auto &e : game.enemies)
             {
-                game.var.ship.powerup_cd = 6;
-                game.var.ship.weapon++;
+                Vector2 v = Vector2Scale(Vector2Subtract(e.pos, e.prev_pos), 1 / game.sim_dt);
+                threat(e.pos.x + e.sprite->width / 2 + v.x * t, e.pos.y + e.sprite->height / 2 + v.y * t, e.sprite->height / 2);
             }
-
-            powerups.erase(std::next(powerups.begin(), i));
+            if (k == 1)
+                cost += fabsf(p.x - target_x) + fabsf(p.y - home_y) * 0.5f;
+        }
+        if (cost < best_cost)
+        {
+            best_cost = cost;
+            best_move = move;
         }
     }
-
-    playerdamage(player, damage);
+    return best_move | INPUT_SHOOT;
 }
 
-void playerinput_handler(ship_t &ship)
+void playerinput_handler(ship_t &ship, uint8_t inputs)
 {
-    const static float origin_speed = ship.speed;
-
-    if (IsKeyDown(KEY_LEFT) || IsKeyDown(KEY_A))
+    TRACE_STAGE("playerinput_handler", STAGE_INPUT);
+    if (inputs & INPUT_LEFT)
     {
         ship.pos.x -= game.delta * ship.speed;
-        if (ship.pos.x < ship.texture->width / 2)
-            ship.pos.x = ship.texture->width / 2;
+        if (ship.pos.x < ship.sprite->width / 2)
+            ship.pos.x = ship.sprite->width / 2;
     }
-    if (IsKeyDown(KEY_RIGHT) || IsKeyDown(KEY_D))
+    if (inputs & INPUT_RIGHT)
     {
         ship.pos.x += game.delta * ship.speed;
-        if (ship.pos.x > GetScreenWidth() - ship.texture->width / 2)
-            ship.pos.x = GetScreenWidth() - ship.texture->width / 2;
+        if (ship.pos.x > game.window_width - ship.sprite->width / 2)
+            ship.pos.x = game.window_width - ship.sprite->width / 2;
     }
-    if (IsKeyDown(KEY_UP) || IsKeyDown(KEY_W))
+    if (inputs & INPUT_UP)
     {
         ship.pos.y -= game.delta * ship.speed;
-        if (ship.pos.y < ship.texture->height / 2)
-            ship.pos.y = ship.texture->height / 2;
+        if (ship.pos.y < ship.sprite->height / 2)
+            ship.pos.y = ship.sprite->height / 2;
     }
-    if (IsKeyDown(KEY_DOWN) || IsKeyDown(KEY_S))
+    if (inputs & INPUT_DOWN)
     {
         ship.pos.y += game.delta * ship.speed;
-        if (ship.pos.y > GetScreenHeight() - ship.texture->height / 2)
-            ship.pos.y = GetScreenHeight() - ship.texture->height / 2;
+        if (ship.pos.y > game.window_height - ship.sprite->height / 2)
+            ship.pos.y = game.window_height - ship.sprite->height / 2;
     }
-    if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT))
+    if (inputs & INPUT_BOOST)
     {
-        if (ship.speed <= origin_speed + 200)
+        if (ship.speed <= ship.base_speed + 200)
         {
             ship.speed += 50;
         }
     }
-    if (IsKeyReleased(KEY_LEFT_SHIFT) || IsKeyReleased(KEY_RIGHT_SHIFT))
+    else if (game.last_inputs & INPUT_BOOST)
     {
-        ship.speed = origin_speed;
+        ship.speed = ship.base_speed;
     }
-    if (IsKeyDown(KEY_SPACE))
+    if (inputs & INPUT_SHOOT)
     {
         if (game.gametime - game.var.ship.last_shot >= game.var.ship.shooting_cooldown)
         {
             game.var.ship.last_shot = game.gametime;
             for (int i = 0; i < game.var.ship.weaponarsenal.size(); i++)
-                game.var.ship.weaponarsenal[i].pos = {game.var.ship.pos.x - game.var.ship.weaponarsenal[i].texture->width / 2, game.var.ship.pos.y - game.var.ship.texture->height / 2};
+                game.var.ship.weaponarsenal[i].pos = {game.var.ship.pos.x - game.var.ship.weaponarsenal[i].sprite->width / 2, game.var.ship.pos.y - game.var.ship.sprite->height / 2};
 
             game.projectiles.push_back(game.var.ship.weaponarsenal[0]);
             if (game.var.ship.weapon)
@@ -440,44 +2868,48 @@ void playerinput_handler(ship_t &ship)
                 game.projectiles.push_back(game.var.ship.weaponarsenal[1]);
                 game.projectiles.push_back(game.var.ship.weaponarsenal[2]);
             }
-            PlaySound(game.sound.gunloop_sound);
+            event_publish(EVENT_SPAWN, PROJECTILES, game.var.ship.weapon ? 3 : 1, game.var.ship.pos);
         }
     }
-    if (IsKeyPressed(KEY_I))
-    {
-        game.var.ship.weapon = ++game.var.ship.weapon % 2;
-    }
 }
 
-void animation_play(animation_t &animation)
+animation_t animation_start(_CLIP clip, Vector2 position, double now)
 {
-    if (animation.currentframe > animation.frames)
-        return;
+    return {position, position, (float)now, (uint16_t)clip, 0};
+}
 
-    if (animation.framescounter += game.delta, animation.framescounter >= (animation.framespeed))
-    {
-        animation.framescounter = 0;
-        animation.framerec.x = (float)(animation.currentframe % animation.rows) * (float)animation.texture->width / animation.rows;
-        animation.framerec.y = (float)(animation.currentframe / animation.rows) * (float)animation.texture->height / animation.cols;
-        animation.currentframe++;
-    }
-    if (animation.currentframe > animation.frames)
-        if (animation.style == LOOP)
-            animation.currentframe = 0;
+// false once a ONCE clip has played its last frame
+bool animation_update(animation_t &animation, double now)
+{
+    const clip_t &clip = game.clips[animation.clip];
+    uint32_t n = (uint32_t)((now - animation.start) * clip.frame_rate);
+    if (n >= clip.frames.size() && clip.style == ONCE)
+        return false;
+    animation.frame = n % clip.frames.size();
+    return true;
 }
 
-void animations_update(std::vector<animation_t> &animations)
+// one pass over all instances, finished ones are dropped
+void animations_update(pool_t<animation_t> &animations, double now)
 {
-    for (int i = 0; i < animations.size(); i++)
+    TRACE_STAGE("animations_update", STAGE_ANIMATIONS);
+    size_t n = animations.size();
+    frame_vector<uint8_t> alive(n);
+    parallel_for(n, 256, [&](size_t begin, size_t end)
     {
-        animation_play(animations[i]);
-        if (animations[i].currentframe > animations[i].frames)
+        for (size_t i = begin; i < end; i++)
+            alive[i] = animation_update(animations[i], now);
+    });
+    // swap-remove in the same order as updating one by one, the flag moves with its animation
+    for (size_t i = 0; i < animations.size();)
+    {
+        if (!alive[i])
         {
-            // if (animations[i].style == LOOP)
-            //     animations[i].currentframe = 0;
-            // else
-            animations.erase(std::next(animations.begin(), i));
+            alive[i] = alive[animations.size() - 1];
+            animations.remove(i);
         }
+        else
+            i++;
     }
 }
 
@@ -508,153 +2940,843 @@ bool update_pos(Vector2 &pos, const Vector2 &dst, float speed)
     }
 }
 
-void enemy_update(std::vector<enemy_t> &enemies)
+// waypoint k of a wave's route, 0 is where the wave enters. the route is a
+// pure function of the seed, so every enemy of a wave flies the same endless
+// route one after another without anything shared or growing
+Vector2 enemy_waypoint(const enemy_t &enemy, uint32_t k)
+{
+    if (k == 0)
+        return enemy.path_origin;
+    rng_t rng;
+    rng.seed(enemy.path_seed ^ ((uint64_t)k << 32));
+    float x = rng.range(game.window_width);
+    float y = rng.range(game.window_height);
+    return {x, y};
+}
+
+void enemy_update(pool_t<enemy_t> &enemies)
+{
+    TRACE_STAGE("enemy_update", STAGE_ENEMIES);
+    parallel_for(enemies.size(), 64, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            auto &enemy = enemies[i];
+            Vector2 approaching = enemy_waypoint(enemy, enemy.pathpos);
+            auto diff = Vector2Subtract(approaching, enemy.pos);
+
+            float diff_length = Vector2Length(diff);
+            if (diff_length < 0.05f)
+            {
+                enemy.pos = approaching;
+                enemy.pathpos++;
+                continue;
+            }
+
+            auto direction = Vector2Normalize(diff);
+            auto walking_distance = Vector2Scale(direction, enemy.speed);
+            auto walking_distance_delta = Vector2Scale(walking_distance, game.delta);
+
+            float wdd_length = Vector2Length(walking_distance_delta);
+            if (wdd_length >= diff_length)
+            {
+                enemy.pos = approaching;
+                enemy.pathpos++;
+            }
+            else
+            {
+                enemy.pos = Vector2Add(enemy.pos, walking_distance_delta);
+            }
+        }
+    });
+}
+
+uint16_t snap_quantize(float v)
+{
+    float q = (v - SNAP_QUANT_MIN) * (65536.0f / SNAP_QUANT_RANGE);
+    if (q < 0)
+        return 0;
+    if (q > 65535)
+        return 65535;
+    return (uint16_t)lrintf(q);
+}
+
+float snap_dequantize(uint16_t q)
+{
+    return SNAP_QUANT_MIN + q * (SNAP_QUANT_RANGE / 65536.0f);
+}
+
+// lsb first bit packing into a caller owned buffer, never allocates
+struct bitwriter_t
 {
-    for (int i = 0; i < enemies.size(); i++)
+    uint8_t *data;
+    size_t capacity;
+    size_t pos;
+    uint64_t acc;
+    int fill;
+    bool overflow;
+
+    void write(uint32_t value, int bits)
+    {
+        acc |= (value & ((1ull << bits) - 1)) << fill;
+        fill += bits;
+        while (fill >= 8)
+        {
+            if (pos < capacity)
+                data[pos++] = acc & 0xFF;
+            else
+                overflow = true;
+            acc >>= 8;
+            fill -= 8;
+        }
+    }
+
+    // exp-golomb, small numbers take few bits
+    void write_ue(uint32_t value)
+    {
+        uint64_t v = (uint64_t)value + 1;
+        int len = 64 - __builtin_clzll(v);
+        write(0, len - 1);
+        write(1, 1);
+        write((uint32_t)v, len - 1);
+    }
+
+    // zigzag + exp-golomb
+    void write_se(int32_t value)
+    {
+        write_ue(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+    }
+
+    // returns the byte size or 0 when the buffer was too small
+    size_t finish()
     {
-        auto &enemy = enemies[i];
-        Vector2 approaching = (*enemy.path)[enemy.pathpos];
-        auto diff = Vector2Subtract(approaching, enemy.pos);
+        if (fill > 0)
+            write(0, 8 - fill);
+        return overflow ? 0 : pos;
+    }
+};
 
-        float diff_length = Vector2Length(diff);
-        if (diff_length < 0.05f)
+struct bitreader_t
+{
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    uint64_t acc;
+    int fill;
+    bool overflow;
+
+    uint32_t read(int bits)
+    {
+        while (fill < bits)
         {
-            enemy.pos = approaching;
-            enemy.pathpos++;
+            if (pos < size)
+                acc |= (uint64_t)data[pos] << fill;
+            else
+                overflow = true;
+            pos++;
+            fill += 8;
+        }
+        uint32_t value = acc & ((1ull << bits) - 1);
+        acc >>= bits;
+        fill -= bits;
+        return value;
+    }
 
-            if (enemy.pathpos >= (*enemy.path).size())
+    uint32_t read_ue()
+    {
+        int zeros = 0;
+        while (read(1) == 0)
+        {
+            if (++zeros > 32 || overflow)
             {
-                enemy.path->push_back({(float)(rand() % GetScreenWidth()), (float)(rand() % GetScreenHeight())});
-                // enemy.pathpos = rand() % ((*enemy.path).size() - 1);
+                overflow = true;
+                return 0;
             }
-            continue;
         }
+        uint64_t v = (1ull << zeros) | read(zeros);
+        return (uint32_t)(v - 1);
+    }
+
+    int32_t read_se()
+    {
+        uint32_t v = read_ue();
+        return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+    }
+};
+
+// fills out with the live entities of a pool in slot order, pos(dense) returns the position
+template <typename F>
+void snapshot_capture_pool(std::vector<snap_entity_t> &out, const slotmap_t &slots, F pos)
+{
+    out.clear();
+    for (uint32_t slot = 0; slot < slots.slot_dense.size(); slot++)
+    {
+        uint32_t dense = slots.slot_dense[slot];
+        if (dense >= slots.dense_slot.size() || slots.dense_slot[dense] != slot)
+            continue;
+        Vector2 p = pos(dense);
+        out.push_back({slot, slots.generation[slot], snap_quantize(p.x), snap_quantize(p.y)});
+    }
+}
+
+void snapshot_capture(snapshot_t &snap, uint32_t tick)
+{
+    snap.tick = tick;
+    snap.inputs = game.inputs;
+    snap.state = 0;
+    if (game.pause)
+        snap.state |= 1 << 7;
+    if (game.exit)
+        snap.state |= 1 << 6;
+    if (game.var.ship.player)
+        snap.state |= 1 << 0;
+    snap.hp = game.var.ship.hp;
+    snap.shield = game.var.ship.shield;
+    snap.x = snap_quantize(game.var.ship.pos.x);
+    snap.y = snap_quantize(game.var.ship.pos.y);
+
+    snapshot_capture_pool(snap.entities[ASTEROIDS], game.asteroids.slots, [](uint32_t i)
+    {
+        return game.asteroids.pos(i);
+    });
+    snapshot_capture_pool(snap.entities[PROJECTILES], game.projectiles.slots, [](uint32_t i)
+    {
+        return game.projectiles.pos(i);
+    });
+    snapshot_capture_pool(snap.entities[ENEMYPROJECTILES], game.enemy_projectiles.slots, [](uint32_t i)
+    {
+        return game.enemy_projectiles.pos(i);
+    });
+    snapshot_capture_pool(snap.entities[EXPLOSIONS], game.explosions.slots, [](uint32_t i)
+    {
+        return game.explosions[i].position;
+    });
+    snapshot_capture_pool(snap.entities[ENEMIES], game.enemies.slots, [](uint32_t i)
+    {
+        return game.enemies[i].pos;
+    });
+}
+
+// worst case encoded size, header plus roughly 22 bytes per entity
+size_t snapshot_max_size(const snapshot_t &snap)
+{
+    size_t entities = 0;
+    for (int c = 0; c < CONTAINERS; c++)
+        entities += snap.entities[c].size();
+    return 64 + CONTAINERS * 8 + entities * 24;
+}
+
+// encodes cur against base, base is nullptr for a full snapshot.
+// returns the byte size or 0 when capacity was too small
+size_t snapshot_encode(const snapshot_t &cur, const snapshot_t *base, uint8_t *out, size_t capacity)
+{
+    bitwriter_t w = {out, capacity, 0, 0, 0, false};
+    w.write(cur.tick, 32);
+    w.write(base ? base->tick : SNAP_NONE, 32);
+    w.write(cur.inputs, 8);
+    w.write(cur.state, 8);
+
+    bool player_same = base && base->hp == cur.hp && base->shield == cur.shield && base->x == cur.x && base->y == cur.y;
+    w.write(player_same, 1);
+    if (!player_same)
+    {
+        w.write_se(cur.hp);
+        w.write_se(cur.shield);
+        w.write(cur.x, 16);
+        w.write(cur.y, 16);
+    }
 
-        auto direction = Vector2Normalize(diff);
-        auto walking_distance = Vector2Scale(direction, enemy.speed);
-        auto walking_distance_delta = Vector2Scale(walking_distance, game.delta);
+    for (int c = 0; c < CONTAINERS; c++)
+    {
+        const snap_entity_t *b = base ? base->entities[c].data() : nullptr;
+        const snap_entity_t *b_end = base ? b + base->entities[c].size() : nullptr;
+        uint32_t next_slot = 0;
 
-        float wdd_length = Vector2Length(walking_distance_delta);
-        if (wdd_length >= diff_length)
+        w.write_ue(cur.entities[c].size());
+        for (auto &e : cur.entities[c])
         {
-            enemy.pos = approaching;
-            enemy.pathpos++;
-            if (enemy.pathpos >= (*enemy.path).size())
+            w.write_ue(e.slot - next_slot);
+            next_slot = e.slot + 1;
+
+            while (b != b_end && b->slot < e.slot)
+                b++;
+            if (b != b_end && b->slot == e.slot && b->generation == e.generation)
             {
-                enemy.pathpos = (*enemy.path).size() - 1;
-                return;
+                w.write(1, 1);
+                int dx = (int)e.x - b->x;
+                int dy = (int)e.y - b->y;
+                w.write(dx != 0 || dy != 0, 1);
+                if (dx != 0 || dy != 0)
+                {
+                    w.write_se(dx);
+                    w.write_se(dy);
+                }
+            }
+            else
+            {
+                w.write(0, 1);
+                w.write_ue(e.generation);
+                w.write(e.x, 16);
+                w.write(e.y, 16);
             }
         }
-        else
+    }
+    return w.finish();
+}
+
+// decodes into out, history is the receiver's SNAP_HISTORY ring of earlier
+// decoded snapshots indexed by tick. fails on garbage or a missing base
+bool snapshot_decode(const uint8_t *data, size_t size, const snapshot_t *history, snapshot_t &out)
+{
+    bitreader_t r = {data, size, 0, 0, 0, false};
+    out.tick = r.read(32);
+    uint32_t base_tick = r.read(32);
+    out.inputs = r.read(8);
+    out.state = r.read(8);
+
+    const snapshot_t *base = nullptr;
+    if (base_tick != SNAP_NONE)
+    {
+        base = &history[base_tick % SNAP_HISTORY];
+        if (base->tick != base_tick || out.tick - base_tick >= SNAP_HISTORY)
+            return false;
+    }
+
+    if (r.read(1))
+    {
+        if (!base)
+            return false;
+        out.hp = base->hp;
+        out.shield = base->shield;
+        out.x = base->x;
+        out.y = base->y;
+    }
+    else
+    {
+        out.hp = r.read_se();
+        out.shield = r.read_se();
+        out.x = r.read(16);
+        out.y = r.read(16);
+    }
+
+    for (int c = 0; c < CONTAINERS; c++)
+    {
+        const snap_entity_t *b = base ? base->entities[c].data() : nullptr;
+        const snap_entity_t *b_end = base ? b + base->entities[c].size() : nullptr;
+        uint32_t next_slot = 0;
+
+        // every entity takes at least 3 bits, anything bigger is garbage
+        uint32_t count = r.read_ue();
+        if (r.overflow || count > (size - r.pos + 8) * 8 / 3)
+            return false;
+        out.entities[c].resize(count);
+        for (auto &e : out.entities[c])
         {
-            enemy.pos = Vector2Add(enemy.pos, walking_distance_delta);
+            e.slot = next_slot + r.read_ue();
+            next_slot = e.slot + 1;
+
+            if (r.read(1))
+            {
+                while (b != b_end && b->slot < e.slot)
+                    b++;
+                if (b == b_end || b->slot != e.slot)
+                    return false;
+                e.generation = b->generation;
+                e.x = b->x;
+                e.y = b->y;
+                if (r.read(1))
+                {
+                    e.x += r.read_se();
+                    e.y += r.read_se();
+                }
+            }
+            else
+            {
+                e.generation = r.read_ue();
+                e.x = r.read(16);
+                e.y = r.read(16);
+            }
         }
+        if (r.overflow)
+            return false;
     }
+    return !r.overflow;
 }
 
-void multi_send()
+// sizes the history for full pools
+void multi_reserve()
 {
+    size_t capacity[CONTAINERS];
+    capacity[ASTEROIDS] = game.asteroids.x.capacity();
+    capacity[PROJECTILES] = game.projectiles.x.capacity();
+    capacity[ENEMYPROJECTILES] = game.enemy_projectiles.x.capacity();
+    capacity[EXPLOSIONS] = game.explosions.items.capacity();
+    capacity[ENEMIES] = game.enemies.items.capacity();
+
+    for (int c = 0; c < CONTAINERS; c++)
+        for (auto &snap : game.net.history)
+            snap.entities[c].reserve(capacity[c]);
+    game.net.reserved = true;
+}
 
-    uint8_t state = 0;
-    if (game.pause)
-        state |= 1 << 7;
-    if (game.exit)
-        state |= 1 << 6;
-    if (game.var.ship.player)
-        state |= 1 << 0;
+// encodes the current state into game.net.buffer, against the last snapshot
+// the peer acked if it is still in the history, otherwise in full. only the
+// first send allocates, the packet itself goes into the frame arena
+void multi_send()
+{
+    TRACE_ZONE("multi_send");
+    if (!game.net.reserved)
+        multi_reserve();
+    snapshot_t &cur = game.net.history[game.net.tick % SNAP_HISTORY];
+    snapshot_capture(cur, game.net.tick);
+
+    const snapshot_t *base = nullptr;
+    if (game.net.acked != SNAP_NONE && game.net.tick - game.net.acked < SNAP_HISTORY)
+        base = &game.net.history[game.net.acked % SNAP_HISTORY];
+
+    size_t capacity = snapshot_max_size(cur);
+    game.net.buffer = (uint8_t *)frame_arena.alloc(capacity, 1);
+    game.net.bytes = game.net.buffer ? snapshot_encode(cur, base, game.net.buffer, capacity) : 0;
+    game.net.tick++;
+
+    // send game.net.buffer, game.net.bytes. the peer answers with the tick it decoded
+}
 
-    uint8_t inputs = 0;
-    if (IsKeyDown(KEY_LEFT) || IsKeyDown(KEY_A))
-        inputs |= 1 << 7;
-    if (IsKeyDown(KEY_RIGHT) || IsKeyDown(KEY_D))
-        inputs |= 1 << 6;
-    if (IsKeyDown(KEY_UP) || IsKeyDown(KEY_W))
-        inputs |= 1 << 5;
-    if (IsKeyDown(KEY_DOWN) || IsKeyDown(KEY_S))
-        inputs |= 1 << 4;
-    if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT))
-        inputs |= 1 << 3;
-    if (IsKeyDown(KEY_SPACE))
-        inputs |= 1 << 2;
-    if (IsKeyDown(KEY_P))
-        inputs |= 1 << 1;
-    if (IsMouseButtonDown(MOUSE_BUTTON_LEFT))
-        inputs |= 1 << 0;
+// the peer decoded tick, later snapshots are encoded against it
+void multi_ack(uint32_t tick)
+{
+    if (tick < game.net.tick && (game.net.acked == SNAP_NONE || tick > game.net.acked))
+        game.net.acked = tick;
+}
 
-    struct ship_multi_t
+// rlgl doesn't report draw calls, so they are estimated from what the draw
+// helpers submit: a texture change starts a new draw call, a full batch is
+// flushed and EndDrawing flushes the rest
+void render_count(const Texture2D &texture, int quads)
+{
+    render_stats_t &r = hud.render;
+    if (texture.id != r.texture || r.batch_draws == 0)
     {
-        int hp;
-        int shield;
-        Vector2 pos;
-    } player;
+        if (r.draw_calls > 0 && texture.id != r.texture)
+            r.texture_switches++;
+        r.texture = texture.id;
+        r.draw_calls++;
+        r.batch_draws++;
+    }
+    r.quads += quads;
+    r.batch_quads += quads;
+    if (r.batch_draws >= HUD_BATCH_DRAWS || r.batch_quads >= HUD_BATCH_QUADS)
+    {
+        r.flushes++;
+        r.batch_draws = 0;
+        r.batch_quads = 0;
+    }
+}
+
+// what the HUD and the metrics show about the sim. taken on the sim side,
+// the render thread only sees it through the render snapshot
+struct sim_stats_t
+{
+    // asteroids, projectiles, enemy projectiles, enemies, explosions, powerups
+    uint32_t entities[6];
+    uint32_t score;
+    int asteroid_spawns;
+    float enemy_spawnspeed;
+    uint8_t load_level;
+    float load;
+    uint32_t asteroids_denied;
+    uint32_t explosions_thinned;
+    uint32_t enemies_denied;
+    // by the gameplay and score readers, 0 unless the ring lapped them
+    uint64_t events_lost;
+};
+
+sim_stats_t sim_stats()
+{
+    sim_stats_t stats;
+    stats.entities[0] = game.asteroids.size();
+    stats.entities[1] = game.projectiles.size();
+    stats.entities[2] = game.enemy_projectiles.size();
+    stats.entities[3] = game.enemies.size();
+    stats.entities[4] = game.explosions.size();
+    stats.entities[5] = game.powerups.size();
+    stats.score = game.highscore;
+    stats.asteroid_spawns = game.spawner.asteroid_spawns;
+    stats.enemy_spawnspeed = game.spawner.enemy_spawnspeed;
+    stats.load_level = governor.level;
+    stats.load = governor.load;
+    stats.asteroids_denied = governor.asteroids_denied;
+    stats.explosions_thinned = governor.explosions_thinned;
+    stats.enemies_denied = governor.enemies_denied;
+    stats.events_lost = gameplay_events.lost + score_events.lost;
+    return stats;
+}
+
+// once per mainloop frame, after EndDrawing
+void hud_frame_end(float frametime)
+{
+    hud.frame_ms[hud.frames++ % HUD_WINDOW] = frametime * 1000;
+    for (int s = 0; s < STAGES; s++)
+        hud.stage_ms[s] = hud.stage_ms[s] * 0.9f + hud.stage_ns[s].exchange(0) / 1e6f * 0.1f;
+    hud.render.flushes++;
+    hud.last_render = hud.render;
+    hud.render = {};
+}
+
+void hud_draw(const sim_stats_t &stats)
+{
+    if (IsKeyPressed(KEY_F3))
+        hud.visible = !hud.visible;
+    if (!hud.visible)
+        return;
+    uint64_t begin = trace_now();
 
-    struct container_t
+    size_t n = std::min(hud.frames, (size_t)HUD_WINDOW);
+    float sorted[HUD_WINDOW];
+    std::copy(hud.frame_ms, hud.frame_ms + n, sorted);
+    auto percentile = [&](float p)
     {
-        enum _CONTAINER type;
-        int size;
-        std::vector<Vector2> positions;
+        if (n == 0)
+            return 0.0f;
+        size_t k = std::min(n - 1, (size_t)(p * n));
+        std::nth_element(sorted, sorted + k, sorted + n);
+        return sorted[k];
     };
+    float p50 = percentile(0.50f);
+    float p95 = percentile(0.95f);
+    float p99 = percentile(0.99f);
+    float max = n ? *std::max_element(sorted, sorted + n) : 0;
+
+    const int size = 10;
+    const int line = 12;
+    int x = game.window_width - 250;
+    int y = 40;
+    int lines = 0;
+    char text[STAGES + 9][96];
+    snprintf(text[lines++], sizeof(text[0]), "frame p50 %.2f p95 %.2f p99 %.2f max %.2f ms", p50, p95, p99, max);
+    for (int s = 0; s < STAGES; s++)
+        snprintf(text[lines++], sizeof(text[0]), "  %-12s %7.3f ms", stage_names[s], hud.stage_ms[s]);
+    snprintf(text[lines++], sizeof(text[0]), "asteroids %u projectiles %u/%u", stats.entities[0], stats.entities[1], stats.entities[2]);
+    snprintf(text[lines++], sizeof(text[0]), "enemies %u explosions %u powerups %u", stats.entities[3], stats.entities[4], stats.entities[5]);
+    snprintf(text[lines++], sizeof(text[0]), "spawns %d enemy spawnspeed %.3f s", stats.asteroid_spawns, stats.enemy_spawnspeed);
+    snprintf(text[lines++], sizeof(text[0]), "draws %u flushes %u tex switches %u quads %u", hud.last_render.draw_calls, hud.last_render.flushes, hud.last_render.texture_switches, hud.last_render.quads);
+    snprintf(text[lines++], sizeof(text[0]), "voices %u mix %.3f ms hud %.3f ms", audio.stats.voices.load(), audio.stats.mix_ns / 1e6f, hud.hud_ms);
+    snprintf(text[lines++], sizeof(text[0]), "events %llu lost %llu audio lost %llu", (unsigned long long)events.head.load(), (unsigned long long)stats.events_lost, (unsigned long long)audio_events.lost);
+    snprintf(text[lines++], sizeof(text[0]), "load %.2f level %u denied %u/%u thinned %u", stats.load, stats.load_level, stats.asteroids_denied, stats.enemies_denied, stats.explosions_thinned);
+    snprintf(text[lines++], sizeof(text[0]), "frame arena %zu/%zu KB peak %zu KB overflows %zu", frame_arena.used.load() / 1024, frame_arena.size / 1024, frame_arena.peak.load() / 1024, frame_arena.overflows.load());
+
+    DrawRectangle(x - 4, y - 4, 254, lines * line + 8, Fade(BLACK, 0.6f));
+    for (int i = 0; i < lines; i++)
+    {
+        DrawText(text[i], x, y + i * line, size, GREEN);
+        render_count(GetFontDefault().texture, strlen(text[i]));
+    }
+    hud.hud_ms = (trace_now() - begin) / 1e6f;
+}
+
+// draws the part of the sprite given in untrimmed sprite coordinates, clipped
+// to what survived trimming. all sprites share a few pages so consecutive
+// draws stay in one rlgl batch
+void DrawSpriteRec(const sprite_t &sprite, Rectangle rec, Vector2 pos, Color tint)
+{
+    float x0 = fmaxf(rec.x, sprite.offset.x);
+    float y0 = fmaxf(rec.y, sprite.offset.y);
+    float x1 = fminf(rec.x + rec.width, sprite.offset.x + sprite.src.width);
+    float y1 = fminf(rec.y + rec.height, sprite.offset.y + sprite.src.height);
+    if (x1 <= x0 || y1 <= y0)
+        return;
+
+    Rectangle src = {sprite.src.x + x0 - sprite.offset.x, sprite.src.y + y0 - sprite.offset.y, x1 - x0, y1 - y0};
+    DrawTextureRec(*sprite.page, src, {pos.x + x0 - rec.x, pos.y + y0 - rec.y}, tint);
+    render_count(*sprite.page, 1);
+}
+
+void DrawSprite(const sprite_t &sprite, Vector2 pos, Color tint)
+{
+    DrawSpriteRec(sprite, {0, 0, (float)sprite.width, (float)sprite.height}, pos, tint);
+}
+
+void DrawHealthbar(const Vector2 &pos, float value)
+{
+    Vector2 position = {pos.x - game.textures.ui_bar_b.width / 2, pos.y};
+    Rectangle fill = {0, 0, (float)game.textures.ui_bar_red.width * value, (float)game.textures.ui_bar_red.height};
+
+    DrawSprite(game.textures.ui_bar_b, position, WHITE);
+    DrawSpriteRec(game.textures.ui_bar_red, fill, position, RED);
+    DrawSprite(game.textures.ui_bar_f, position, WHITE);
+}
+
+void DrawShieldbar(const Vector2 &pos, float value)
+{
+    Vector2 position = {pos.x - game.textures.ui_bar_b.width / 2, pos.y};
+    Rectangle fill = {0, 0, (float)game.textures.ui_bar_blue.width * value, (float)game.textures.ui_bar_blue.height};
+
+    DrawSprite(game.textures.ui_bar_b, position, WHITE);
+    DrawSpriteRec(game.textures.ui_bar_blue, fill, position, BLUE);
+    DrawSprite(game.textures.ui_bar_f, position, WHITE);
+}
+
+void DrawAnimation(const animation_t &animation, Vector2 pos)
+{
+    const clip_t &clip = game.clips[animation.clip];
+    DrawSpriteRec(*clip.sprite, clip.frames[animation.frame], pos, WHITE);
+}
+
+void DrawAnimation(const animation_t &animation)
+{
+    DrawAnimation(animation, animation.position);
+}
+
+void background_update(float delta)
+{
+    for (auto &layer : game.background)
+    {
+        if (layer.texture.height == 0)
+            continue;
+        layer.scroll = fmodf(layer.scroll + delta * layer.speed / layer.scale, layer.texture.height);
+    }
+}
+
+// the source rect spans the whole screen in texel space and runs past the
+// texture edges, the repeat wrap mode tiles it on the GPU
+void background_draw(size_t layers = SIZE_MAX)
+{
+    for (auto &layer : game.background)
+    {
+        if (layers-- == 0)
+            break;
+        Rectangle src = {0, -layer.scroll, game.window_width / layer.scale, game.window_height / layer.scale};
+        Rectangle dst = {0, 0, (float)game.window_width, (float)game.window_height};
+        DrawTexturePro(layer.texture, src, dst, {0, 0}, 0, layer.tint);
+        render_count(layer.texture, 1);
+    }
+}
+
+// prometheus exporter on 127.0.0.1, --metrics PORT. the game thread publishes
+// a snapshot every frame through a seqlock, the exporter thread retries its
+// copy if a publish raced it, so a scrape never blocks a frame
+#define METRICS_BUCKETS 9
+// per client, for the request and for the response
+#define METRICS_TIMEOUT_MS 500
+// after a failed accept()
+#define METRICS_BACKOFF_MS 100
+
+const float metrics_bucket_ms[METRICS_BUCKETS] = {1, 2, 4, 8, 16, 33, 50, 100, 250};
+const char *metrics_containers[] = {"asteroids", "projectiles", "enemy_projectiles", "enemies", "explosions", "powerups"};
+
+// doubles only, it is published as a flat array
+struct metrics_t
+{
+    // cumulative, the last bucket is +Inf
+    double frame_buckets[METRICS_BUCKETS + 1];
+    double frame_sum;
+    double frames;
+    double stage[STAGES];
+    double entities[6];
+    double voices;
+    double score;
+    double load;
+    double load_level;
+    double asteroids_denied;
+    double explosions_thinned;
+    double enemies_denied;
+    double events_lost;
+};
+
+#define METRICS_VALUES (sizeof(metrics_t) / sizeof(double))
+
+struct
+{
+    int port = 0;
+    // game thread only
+    metrics_t local;
+    std::atomic<uint32_t> seq{0};
+    std::atomic<double> values[METRICS_VALUES];
+} metrics;
+
+void metrics_publish(float frametime, const sim_stats_t &stats)
+{
+    if (!metrics.port)
+        return;
+    metrics_t &m = metrics.local;
+    float ms = frametime * 1000;
+    for (int b = 0; b < METRICS_BUCKETS; b++)
+        if (ms <= metrics_bucket_ms[b])
+            m.frame_buckets[b]++;
+    m.frame_buckets[METRICS_BUCKETS]++;
+    m.frame_sum += frametime;
+    m.frames++;
+    for (int s = 0; s < STAGES; s++)
+        m.stage[s] = hud.stage_ms[s] / 1000;
+    for (int c = 0; c < 6; c++)
+        m.entities[c] = stats.entities[c];
+    m.voices = audio.stats.voices;
+    m.score = stats.score;
+    m.load = stats.load;
+    m.load_level = stats.load_level;
+    m.asteroids_denied = stats.asteroids_denied;
+    m.explosions_thinned = stats.explosions_thinned;
+    m.enemies_denied = stats.enemies_denied;
+    m.events_lost = stats.events_lost;
+
+    const double *src = (const double *)&m;
+    uint32_t seq = metrics.seq.load(std::memory_order_relaxed);
+    metrics.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < METRICS_VALUES; i++)
+        metrics.values[i].store(src[i], std::memory_order_relaxed);
+    metrics.seq.store(seq + 2, std::memory_order_release);
+}
+
+void metrics_read(metrics_t &out)
+{
+    double *dst = (double *)&out;
+    uint32_t seq;
+    do
+    {
+        seq = metrics.seq.load(std::memory_order_acquire);
+        if (seq & 1)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t i = 0; i < METRICS_VALUES; i++)
+            dst[i] = metrics.values[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || metrics.seq.load(std::memory_order_relaxed) != seq);
+}
 
-    struct send_t
+double metrics_rss()
+{
+    long pages = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file)
     {
-        uint8_t inputs;
-        uint8_t state;
-        ship_multi_t player;
-        container_t asteroids;
-        container_t projectiles;
-        container_t enemy_projectiles;
-        container_t explosions;
-    } datablock;
-
-    datablock.player.hp = game.var.ship.hp;
-    datablock.player.shield = game.var.ship.shield;
-    datablock.player.pos = game.var.ship.pos;
-
-    datablock.asteroids = {ASTEROIDS};
-    datablock.projectiles = {PROJECTILES};
-    datablock.enemy_projectiles = {ENEMYPROJECTILES};
-    datablock.explosions = {EXPLOSIONS};
-
-    datablock.asteroids.size = game.asteroids.size();
-    datablock.projectiles.size = game.projectiles.size();
-    datablock.enemy_projectiles.size = game.enemy_projectiles.size();
-    datablock.explosions.size = game.explosions.size();
-
-    for (auto &e : game.asteroids)
-        datablock.asteroids.positions.push_back(e.pos);
-    for (auto &e : game.projectiles)
-        datablock.projectiles.positions.push_back(e.pos);
-    for (auto &e : game.enemy_projectiles)
-        datablock.enemy_projectiles.positions.push_back(e.pos);
-    for (auto &e : game.explosions)
-        datablock.explosions.positions.push_back(e.position);
-
-    // send datablock , sizeof(datablock)
+        if (fscanf(file, "%*s %ld", &pages) != 1)
+            pages = 0;
+        fclose(file);
+    }
+#ifndef _WIN32
+    return (double)pages * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
 }
 
-void DrawHealthbar(const Vector2 &pos, float value)
+void metrics_format(std::string &body)
 {
-    Vector2 position = {pos.x - game.textures.ui_bar_b.width / 2, pos.y};
-    Rectangle fill = {0, 0, (float)game.textures.ui_bar_red.width * value, (float)game.textures.ui_bar_red.height};
+    metrics_t m;
+    metrics_read(m);
+    char line[256];
+    auto add = [&](const char *fmt, ...)
+    {
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(line, sizeof(line), fmt, args);
+        va_end(args);
+        body += line;
+    };
 
-    DrawTextureV(game.textures.ui_bar_b, position, WHITE);
-    DrawTextureRec(game.textures.ui_bar_red, fill, position, RED);
-    DrawTextureV(game.textures.ui_bar_f, position, WHITE);
+    add("# HELP fgradius_frame_seconds Frame time.\n# TYPE fgradius_frame_seconds histogram\n");
+    for (int b = 0; b < METRICS_BUCKETS; b++)
+        add("fgradius_frame_seconds_bucket{le=\"%g\"} %.0f\n", metrics_bucket_ms[b] / 1000, m.frame_buckets[b]);
+    add("fgradius_frame_seconds_bucket{le=\"+Inf\"} %.0f\n", m.frame_buckets[METRICS_BUCKETS]);
+    add("fgradius_frame_seconds_sum %.6f\nfgradius_frame_seconds_count %.0f\n", m.frame_sum, m.frames);
+
+    add("# HELP fgradius_stage_seconds Smoothed time per frame spent in each stage.\n# TYPE fgradius_stage_seconds gauge\n");
+    for (int s = 0; s < STAGES; s++)
+        add("fgradius_stage_seconds{stage=\"%s\"} %.9f\n", stage_names[s], m.stage[s]);
+
+    add("# HELP fgradius_entities Live entities per container.\n# TYPE fgradius_entities gauge\n");
+    for (int c = 0; c < 6; c++)
+        add("fgradius_entities{container=\"%s\"} %.0f\n", metrics_containers[c], m.entities[c]);
+
+    add("# HELP fgradius_audio_voices Sound effect voices playing.\n# TYPE fgradius_audio_voices gauge\nfgradius_audio_voices %.0f\n", m.voices);
+    add("# HELP fgradius_score Score of the running session.\n# TYPE fgradius_score gauge\nfgradius_score %.0f\n", m.score);
+    add("# HELP fgradius_load Frame or sim step time over its budget, whichever is higher.\n# TYPE fgradius_load gauge\nfgradius_load %.3f\n", m.load);
+    add("# HELP fgradius_load_level Load governor level, 0 sheds nothing.\n# TYPE fgradius_load_level gauge\nfgradius_load_level %.0f\n", m.load_level);
+    add("# HELP fgradius_governor_shed_total Spawns and effects the load governor dropped this session.\n# TYPE fgradius_governor_shed_total counter\n");
+    add("fgradius_governor_shed_total{what=\"asteroids\"} %.0f\n", m.asteroids_denied);
+    add("fgradius_governor_shed_total{what=\"explosions\"} %.0f\n", m.explosions_thinned);
+    add("fgradius_governor_shed_total{what=\"enemies\"} %.0f\n", m.enemies_denied);
+    add("# HELP fgradius_events_lost_total Events the gameplay and score readers missed because the ring lapped them.\n# TYPE fgradius_events_lost_total counter\nfgradius_events_lost_total %.0f\n", m.events_lost);
+    add("# HELP fgradius_resident_bytes Resident set size.\n# TYPE fgradius_resident_bytes gauge\nfgradius_resident_bytes %.0f\n", metrics_rss());
 }
 
-void DrawShieldbar(const Vector2 &pos, float value)
+#ifndef _WIN32
+void metrics_serve(int server)
 {
-    Vector2 position = {pos.x - game.textures.ui_bar_b.width / 2, pos.y};
-    Rectangle fill = {0, 0, (float)game.textures.ui_bar_blue.width * value, (float)game.textures.ui_bar_blue.height};
-
-    DrawTextureV(game.textures.ui_bar_b, position, WHITE);
-    DrawTextureRec(game.textures.ui_bar_blue, fill, position, BLUE);
-    DrawTextureV(game.textures.ui_bar_f, position, WHITE);
+    trace_thread_name("metrics");
+    std::string body;
+    std::string response;
+    char request[1024];
+    while (true)
+    {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0)
+        {
+            // out of descriptors and the like don't clear up by retrying right away
+            if (errno != EINTR && errno != ECONNABORTED)
+                std::this_thread::sleep_for(std::chrono::milliseconds(METRICS_BACKOFF_MS));
+            continue;
+        }
+        // a client that connects and goes quiet must not hold up the next scrape
+        timeval timeout = {0, METRICS_TIMEOUT_MS * 1000};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        ssize_t n = recv(client, request, sizeof(request) - 1, 0);
+        request[n > 0 ? n : 0] = 0;
+
+        body.clear();
+        const char *status = "200 OK";
+        if (!strncmp(request, "GET /metrics", 12))
+            metrics_format(body);
+        else
+        {
+            status = "404 Not Found";
+            body = "try /metrics\n";
+        }
+        char header[160];
+        snprintf(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", status, body.size());
+        response = header;
+        response += body;
+        for (size_t sent = 0; sent < response.size();)
+        {
+            ssize_t w = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (w <= 0)
+                break;
+            sent += w;
+        }
+        close(client);
+    }
 }
+#endif
 
-void DrawAnimation(const animation_t &animation)
+bool metrics_start(int port)
 {
-    DrawTextureRec(*animation.texture, animation.framerec, animation.position, WHITE);
+#ifndef _WIN32
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (server < 0 || bind(server, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(server, 4) < 0)
+    {
+        printf("METRICS: couldnt listen on 127.0.0.1:%d\n", port);
+        if (server >= 0)
+            close(server);
+        return false;
+    }
+    metrics.port = port;
+    std::thread(metrics_serve, server).detach();
+    printf("METRICS: serving http://127.0.0.1:%d/metrics\n", port);
+    return true;
+#else
+    printf("METRICS: not supported on this platform\n");
+    return false;
+#endif
 }
 
 void startscreen()
@@ -694,6 +3816,9 @@ void startscreen()
     PlayMusicStream(game.sound.opening);
     while (!WindowShouldClose())
     {
+        TRACE_ZONE("startscreen");
+        trace_hotkey();
+        audio_flush();
 
         UpdateMusicStream(game.sound.opening);
         game.delta = GetFrameTime();
@@ -715,12 +3840,12 @@ void startscreen()
 
             if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
             {
-                PlaySound(game.sound.select);
+                play_sound(SFX_SELECT);
                 return;
             }
 
             if (hovertime < maxtime && fmod(hovertime, 0.05f) <= game.delta)
-                PlaySound(game.sound.click);
+                play_sound(SFX_CLICK);
         }
         else
         {
@@ -738,30 +3863,28 @@ void startscreen()
         {
             if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
             {
-                PlaySound(game.sound.select);
+                play_sound(SFX_SELECT);
                 exit(0);
             }
             exit_opa = 120;
         }
 
-        if (game.bg_scrollpos -= game.delta * game.bg_scollspeed, game.bg_scrollpos <= -game.textures.bg_tex.height * 2)
-            game.bg_scrollpos = 0;
+        background_update(game.delta);
 
         if (update_pos(game.var.ship.pos, pos[pos_pos], 20))
             pos_pos = ++pos_pos % pos.size();
 
         Color title = ColorFromHSV(hue, 1, 1);
 
-        animation_play(game.animations.boost);
-        game.animations.boost.position = {game.var.ship.pos.x - game.animations.boost.framerec.width / 2, game.var.ship.pos.y + game.var.ship.texture->height / 2};
+        animation_update(game.var.boost, GetTime());
+        game.var.boost.position = {game.var.ship.pos.x - game.clips[CLIP_BOOST].width / 2, game.var.ship.pos.y + game.var.ship.sprite->height / 2};
 
         BeginDrawing();
         ClearBackground(BLACK);
-        DrawTextureEx(game.textures.bg_tex, {-20, -game.bg_scrollpos}, 0, 2, WHITE);
-        DrawTextureEx(game.textures.bg_tex, {20, -game.textures.bg_tex.height * 2 - game.bg_scrollpos}, 0, 2, RAYWHITE);
+        background_draw();
 
-        DrawTexture(*game.var.ship.texture, game.var.ship.pos.x - game.var.ship.texture->width / 2, game.var.ship.pos.y - game.var.ship.texture->height / 2, WHITE);
-        DrawTextureRec(*game.animations.boost.texture, game.animations.boost.framerec, game.animations.boost.position, WHITE);
+        DrawSprite(*game.var.ship.sprite, {game.var.ship.pos.x - game.var.ship.sprite->width / 2, game.var.ship.pos.y - game.var.ship.sprite->height / 2}, WHITE);
+        DrawAnimation(game.var.boost);
 
         for (size_t i = 0; i < box.size(); i++)
         {
@@ -800,9 +3923,11 @@ void fly_to_start()
 
     while (!reached && !WindowShouldClose())
     {
+        TRACE_ZONE("fly_to_start");
+        trace_hotkey();
+        audio_flush();
         game.delta = GetFrameTime();
-        if (game.bg_scrollpos -= game.delta * game.bg_scollspeed, game.bg_scrollpos <= -game.textures.bg_tex.height * 2)
-            game.bg_scrollpos = 0;
+        background_update(game.delta);
 
         if (update_pos(game.var.ship.pos, destination, speed))
         {
@@ -824,222 +3949,1074 @@ void fly_to_start()
         }
         else if (speed > 300)
         {
-            speed -= 100 * game.delta;
+            speed -= 100 * game.delta;
+        }
+        else
+            speed = 300;
+
+        if (destination != game.ship_startpos)
+        {
+            animation_update(game.var.boost, GetTime());
+            game.var.boost.position = {game.var.ship.pos.x - game.clips[CLIP_BOOST].width / 2, game.var.ship.pos.y + game.var.ship.sprite->height / 2};
+        }
+
+        BeginDrawing();
+        ClearBackground(BLACK);
+        background_draw();
+        DrawSprite(*game.var.ship.sprite, {game.var.ship.pos.x - game.var.ship.sprite->width / 2, game.var.ship.pos.y - game.var.ship.sprite->height / 2}, WHITE);
+        if (destination != game.ship_startpos)
+            DrawAnimation(game.var.boost);
+        EndDrawing();
+    }
+}
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ p[i]) * 0x100000001B3ull;
+    return hash;
+}
+
+// level timelines, --level FILE. a level is a list of spawn events sorted by
+// time, compiled from text by --compile-level and mapped read only at runtime.
+// the spawner walks it with a cursor, so a tick only costs the events that
+// are due, and the pages behind the cursor are handed back to the kernel, so
+// long levels don't stay resident. without a level the built in waves spawn.
+// text format, # starts a comment:
+//   TIME ARCHETYPE PATH [COUNT [SPEED [X]]]
+//   loop SECONDS
+// TIME is in seconds from the start, ARCHETYPE one of archetype_names. PATH
+// picks an enemy's route, the same id always flies the same route. COUNT
+// asteroids come as one wave, COUNT enemies one after another. SPEED 0 keeps
+// the enemy's current speed. X is where it enters in screen widths, -1 for
+// anywhere. with loop the timeline starts over every SECONDS, which can't be
+// shorter than the timeline. layout: level_header_t, then level_event_t * count
+#define LEVEL_MAGIC 0x4C564746
+#define LEVEL_VERSION 1
+// seconds between the enemies of one event
+#define LEVEL_ENEMY_GAP 0.6f
+
+enum _ARCHETYPE
+{
+    ARCH_ASTEROIDS,
+    ARCH_ENEMY,
+    ARCH_POWUP_LIFE,
+    ARCH_POWUP_SHIELD,
+    ARCH_POWUP_WEAPON,
+    ARCHETYPES
+};
+
+const char *archetype_names[ARCHETYPES] = {"asteroids", "enemy", "life", "shield", "weapon"};
+
+struct level_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    // time of the last event
+    float duration;
+    // 0 plays the timeline once
+    float loop;
+    uint32_t reserved;
+    // hash_bytes() of the events, replays check it
+    uint64_t hash;
+};
+
+struct level_event_t
+{
+    float time;
+    uint8_t archetype;
+    uint8_t path;
+    uint16_t count;
+    float speed;
+    float x;
+};
+
+struct
+{
+    uint8_t *data = nullptr;
+    size_t size = 0;
+    const level_header_t *header = nullptr;
+    const level_event_t *events = nullptr;
+    // sim thread only
+    size_t cursor = 0;
+    // gametime the current pass started at
+    double offset = 0;
+    // bytes from the start already handed back
+    size_t released = 0;
+} level;
+
+int level_compile(const char *src_path, const char *dst_path)
+{
+    FILE *src = fopen(src_path, "r");
+    if (!src)
+    {
+        printf("LEVEL: couldnt open %s\n", src_path);
+        return 1;
+    }
+    std::vector<level_event_t> timeline;
+    level_header_t header = {LEVEL_MAGIC, LEVEL_VERSION, 0, 0, 0, 0, 0};
+    char line[256];
+    int number = 0;
+    while (fgets(line, sizeof(line), src))
+    {
+        number++;
+        char *comment = strchr(line, '#');
+        if (comment)
+            *comment = 0;
+        char name[32];
+        float time;
+        int path = 0, count = 1;
+        float speed = 0, x = -1;
+        char keyword[8];
+        if (sscanf(line, " %7s", keyword) == 1 && !strcmp(keyword, "loop"))
+        {
+            if (sscanf(line, " loop %f", &header.loop) != 1)
+            {
+                printf("LEVEL: %s:%d: expected loop SECONDS\n", src_path, number);
+                fclose(src);
+                return 1;
+            }
+            continue;
+        }
+        int fields = sscanf(line, "%f %31s %d %d %f %f", &time, name, &path, &count, &speed, &x);
+        if (fields <= 0)
+            continue;
+        int archetype = 0;
+        while (archetype < ARCHETYPES && strcmp(name, archetype_names[archetype]))
+            archetype++;
+        if (fields < 3 || archetype == ARCHETYPES || time < 0 || path < 0 || path > 255 || count < 1 || count > 65535)
+        {
+            printf("LEVEL: %s:%d: expected TIME ARCHETYPE PATH [COUNT [SPEED [X]]]\n", src_path, number);
+            fclose(src);
+            return 1;
+        }
+        level_event_t e = {time, (uint8_t)archetype, (uint8_t)path, (uint16_t)count, speed, x};
+        if (archetype != ARCH_ENEMY)
+        {
+            timeline.push_back(e);
+            continue;
+        }
+        e.count = 1;
+        for (int i = 0; i < count; i++, e.time += LEVEL_ENEMY_GAP)
+            timeline.push_back(e);
+    }
+    fclose(src);
+
+    std::stable_sort(timeline.begin(), timeline.end(), [](const level_event_t &a, const level_event_t &b)
+    {
+        return a.time < b.time;
+    });
+    header.count = timeline.size();
+    header.duration = timeline.empty() ? 0 : timeline.back().time;
+    header.hash = hash_bytes(0xCBF29CE484222325ull, timeline.data(), timeline.size() * sizeof(level_event_t));
+    if (header.loop < 0 || (header.loop > 0 && header.loop < header.duration))
+    {
+        printf("LEVEL: %s: loop %.2f s is shorter than the timeline, %.2f s\n", src_path, header.loop, header.duration);
+        return 1;
+    }
+
+    FILE *dst = fopen(dst_path, "wb");
+    if (!dst)
+    {
+        printf("LEVEL: couldnt create %s\n", dst_path);
+        return 1;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, dst) == 1 &&
+                   fwrite(timeline.data(), sizeof(level_event_t), timeline.size(), dst) == timeline.size();
+    if (fclose(dst) != 0 || !written)
+    {
+        // a truncated level would only be caught by level_open on the next run
+        printf("LEVEL: couldnt write %s\n", dst_path);
+        remove(dst_path);
+        return 1;
+    }
+    printf("LEVEL: %u events over %.2f s to %s\n", header.count, header.duration, dst_path);
+    return 0;
+}
+
+bool level_open(const char *path)
+{
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (file)
+    {
+        fseek(file, 0, SEEK_END);
+        level.size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        level.data = (uint8_t *)malloc(level.size);
+        if (fread(level.data, 1, level.size, file) != level.size)
+        {
+            free(level.data);
+            level.data = nullptr;
+        }
+        fclose(file);
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            level.data = (uint8_t *)map;
+            level.size = st.st_size;
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+#endif
+    if (!level.data)
+    {
+        printf("LEVEL: couldnt open %s\n", path);
+        return false;
+    }
+
+    // only the header is checked, the events are streamed in as they come due
+    auto header = (const level_header_t *)level.data;
+    if (level.size < sizeof(level_header_t) || header->magic != LEVEL_MAGIC || header->version != LEVEL_VERSION ||
+        level.size < sizeof(level_header_t) + header->count * sizeof(level_event_t) || (header->loop > 0 && header->loop < header->duration))
+    {
+        printf("LEVEL: %s is not a level\n", path);
+#ifdef _WIN32
+        free(level.data);
+#else
+        munmap(level.data, level.size);
+#endif
+        level.data = nullptr;
+        level.size = 0;
+        return false;
+    }
+    level.header = header;
+    level.events = (const level_event_t *)(level.data + sizeof(level_header_t));
+    printf("LEVEL: %u events over %.2f s%s\n", header->count, header->duration, header->loop > 0 ? ", looping" : "");
+    return true;
+}
+
+uint64_t level_hash()
+{
+    return level.header ? level.header->hash : 0;
+}
+
+void level_reset()
+{
+    level.cursor = 0;
+    level.offset = 0;
+}
+
+// hands the pages the cursor is done with back, they are read in again if
+// the level loops
+void level_release()
+{
+#ifndef _WIN32
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t done = (sizeof(level_header_t) + level.cursor * sizeof(level_event_t)) / page * page;
+    if (done < level.released)
+        level.released = 0;
+    if (done > level.released)
+    {
+        madvise(level.data + level.released, done - level.released, MADV_DONTNEED);
+        level.released = done;
+    }
+#endif
+}
+
+void level_spawn_event(const level_event_t &e)
+{
+    float width = game.window_width;
+    if (e.archetype == ARCH_ASTEROIDS)
+    {
+        int spawns = governor_admit_asteroids(e.count);
+        asteroids_spawn(game.asteroids, &game.textures.asteroid_textures[game.rng.spawn.range(game.textures.asteroid_textures.size())], spawns);
+        if (spawns > 0)
+            event_publish(EVENT_SPAWN, ASTEROIDS, spawns, {0, 0});
+    }
+    else if (e.archetype == ARCH_ENEMY)
+    {
+        if (!governor_admit_enemy())
+            return;
+        enemy_t enemy = game.var.enemy;
+        if (e.speed > 0)
+            enemy.speed = e.speed;
+        if (e.x >= 0)
+            enemy.path_origin.x = e.x * width;
+        rng_t route;
+        route.seed(e.path);
+        enemy.path_seed = ((uint64_t)route.next() << 32) | route.next();
+        game.enemies.push_back(enemy);
+        event_publish(EVENT_SPAWN, ENEMIES, 1, enemy.pos);
+    }
+    else
+    {
+        _CLIP clip = e.archetype == ARCH_POWUP_LIFE ? CLIP_POWUP_LIFE : e.archetype == ARCH_POWUP_SHIELD ? CLIP_POWUP_SHIELD : CLIP_POWUP_WEAPON;
+        for (int i = 0; i < e.count; i++)
+        {
+            Vector2 position = {e.x >= 0 ? e.x * width : (float)game.rng.event.range(width), 0};
+            game.powerups.push_back(animation_start(clip, position, game.gametime));
+            event_publish(EVENT_SPAWN, CONTAINERS, 1, position, clip);
+        }
+    }
+}
+
+// everything the level has due by now
+void level_spawn()
+{
+    const level_header_t &header = *level.header;
+    while (header.count > 0)
+    {
+        if (level.cursor == header.count)
+        {
+            if (header.loop <= 0)
+                break;
+            level.cursor = 0;
+            level.offset += header.loop;
+        }
+        const level_event_t &e = level.events[level.cursor];
+        if (level.offset + e.time > game.gametime)
+            break;
+        level.cursor++;
+        level_spawn_event(e);
+    }
+    level_release();
+}
+
+// record/replay. a recording is the session seed plus the clamped frame time,
+// input mask and load level of every unpaused frame, which is all the
+// simulation reads, so feeding it back reproduces the session bit for bit.
+// layout: replay_header_t, then frames * (float delta, uint8_t inputs, uint8_t load_level)
+#define REPLAY_MAGIC 0x50524746
+#define REPLAY_VERSION 4
+
+struct replay_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t sim_hz;
+    uint32_t frames;
+    uint64_t seed;
+    // sim_hash() after the last frame
+    uint64_t hash;
+    // level_hash() of the level played, 0 for the built in waves
+    uint64_t level_hash;
+};
+
+struct replay_frame_t
+{
+    float delta;
+    uint8_t inputs;
+    uint8_t load_level;
+};
+
+struct
+{
+    const char *record_path = nullptr;
+    FILE *file = nullptr;
+    replay_header_t header;
+    std::vector<replay_frame_t> frames;
+    size_t cursor = 0;
+    bool recording = false;
+    bool playing = false;
+} replay;
+
+// fingerprint of the simulation state, a replay has to end on the same value
+uint64_t sim_hash()
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    hash = hash_bytes(hash, &game.gametime, sizeof(game.gametime));
+    hash = hash_bytes(hash, &game.highscore, sizeof(game.highscore));
+    hash = hash_bytes(hash, &game.var.ship.pos, sizeof(game.var.ship.pos));
+    hash = hash_bytes(hash, &game.var.ship.hp, sizeof(game.var.ship.hp));
+    hash = hash_bytes(hash, &game.var.ship.shield, sizeof(game.var.ship.shield));
+    hash = hash_bytes(hash, game.asteroids.x.data(), game.asteroids.size() * sizeof(float));
+    hash = hash_bytes(hash, game.asteroids.y.data(), game.asteroids.size() * sizeof(float));
+    hash = hash_bytes(hash, game.projectiles.x.data(), game.projectiles.size() * sizeof(float));
+    hash = hash_bytes(hash, game.projectiles.y.data(), game.projectiles.size() * sizeof(float));
+    hash = hash_bytes(hash, game.enemy_projectiles.x.data(), game.enemy_projectiles.size() * sizeof(float));
+    hash = hash_bytes(hash, game.enemy_projectiles.y.data(), game.enemy_projectiles.size() * sizeof(float));
+    for (auto &e : game.enemies)
+        hash = hash_bytes(hash, &e.pos, sizeof(e.pos));
+    return hash;
+}
+
+bool replay_load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        printf("REPLAY: couldnt open %s\n", path);
+        return false;
+    }
+    replay_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION)
+    {
+        printf("REPLAY: %s is not a replay\n", path);
+        fclose(file);
+        return false;
+    }
+    replay.frames.resize(header.frames);
+    for (auto &frame : replay.frames)
+    {
+        if (fread(&frame.delta, sizeof(frame.delta), 1, file) != 1 || fread(&frame.inputs, sizeof(frame.inputs), 1, file) != 1 ||
+            fread(&frame.load_level, sizeof(frame.load_level), 1, file) != 1)
+        {
+            printf("REPLAY: %s is truncated\n", path);
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+
+    replay.header = header;
+    replay.cursor = 0;
+    replay.playing = true;
+    game.sim_hz = header.sim_hz;
+    printf("REPLAY: %u frames at %d Hz seed %llu\n", header.frames, header.sim_hz, (unsigned long long)header.seed);
+    return true;
+}
+
+bool replay_next(float &delta, uint8_t &inputs, uint8_t &load_level)
+{
+    if (replay.cursor >= replay.frames.size())
+        return false;
+    delta = replay.frames[replay.cursor].delta;
+    inputs = replay.frames[replay.cursor].inputs;
+    load_level = replay.frames[replay.cursor].load_level;
+    replay.cursor++;
+    return true;
+}
+
+void replay_write(float delta, uint8_t inputs, uint8_t load_level)
+{
+    fwrite(&delta, sizeof(delta), 1, replay.file);
+    fwrite(&inputs, sizeof(inputs), 1, replay.file);
+    fwrite(&load_level, sizeof(load_level), 1, replay.file);
+    replay.header.frames++;
+}
+
+void sim_seed(uint64_t seed)
+{
+    game.seed = seed;
+    game.rng.spawn.seed(seed);
+    game.rng.enemy.seed(seed + 1);
+    game.rng.event.seed(seed + 2);
+}
+
+// picks the session seed and starts recording, call before mainloop_init()
+void replay_session_begin()
+{
+    if (replay.playing)
+        sim_seed(replay.header.seed);
+    else if (game.seed_fixed)
+        sim_seed(game.seed);
+    else
+        sim_seed((uint64_t)std::chrono::steady_clock::now().time_since_epoch().count());
+
+    if (!replay.record_path || replay.playing)
+        return;
+    replay.file = fopen(replay.record_path, "wb");
+    if (!replay.file)
+    {
+        printf("REPLAY: couldnt create %s\n", replay.record_path);
+        return;
+    }
+    replay.header = {REPLAY_MAGIC, REPLAY_VERSION, game.sim_hz, 0, game.seed, 0, level_hash()};
+    fwrite(&replay.header, sizeof(replay.header), 1, replay.file);
+    replay.recording = true;
+}
+
+// finishes the recording or checks the replay, false when a replay diverged
+bool replay_session_end()
+{
+    uint64_t hash = sim_hash();
+    if (replay.recording)
+    {
+        replay.header.hash = hash;
+        fseek(replay.file, 0, SEEK_SET);
+        fwrite(&replay.header, sizeof(replay.header), 1, replay.file);
+        fclose(replay.file);
+        replay.file = nullptr;
+        replay.recording = false;
+        printf("REPLAY: recorded %u frames to %s\n", replay.header.frames, replay.record_path);
+    }
+    if (replay.playing)
+    {
+        replay.playing = false;
+        bool match = replay.cursor == replay.frames.size() && hash == replay.header.hash;
+        printf("REPLAY: %s after %zu of %zu frames\n", match ? "matches" : "diverged", replay.cursor, replay.frames.size());
+        return match;
+    }
+    return true;
+}
+
+void sim_store_prev()
+{
+    game.var.ship.prev_pos = game.var.ship.pos;
+    game.asteroids.prev_x = game.asteroids.x;
+    game.asteroids.prev_y = game.asteroids.y;
+    game.projectiles.prev_x = game.projectiles.x;
+    game.projectiles.prev_y = game.projectiles.y;
+    game.enemy_projectiles.prev_x = game.enemy_projectiles.x;
+    game.enemy_projectiles.prev_y = game.enemy_projectiles.y;
+    for (auto &e : game.enemies)
+        e.prev_pos = e.pos;
+    for (auto &e : game.powerups)
+        e.prev_position = e.position;
+}
+
+// event consumers. gameplay, score and fx run inside the sim step, audio on
+// whichever thread owns the audio
+
+// fx and audio may drop events, gameplay and score must not: a lost event is
+// lost damage or score. a step never publishes a whole ring, this says so if
+// one did
+void event_check_lapped(const event_reader_t &reader, uint64_t lost, const char *name)
+{
+    if (reader.lost != lost)
+        printf("EVENTS: %s reader lapped, %llu events lost\n", name, (unsigned long long)(reader.lost - lost));
+}
+
+void gameplay_consume(ship_t &player)
+{
+    int damage = 0;
+    uint64_t lost = gameplay_events.lost;
+    event_t e;
+    while (event_next(gameplay_events, e))
+    {
+        if (e.type == EVENT_DAMAGE)
+            damage += e.value;
+        else if (e.type == EVENT_PICKUP && e.clip == CLIP_POWUP_LIFE)
+        {
+            damage -= 500;
+            player.max_hp += 200;
+        }
+        else if (e.type == EVENT_PICKUP && e.clip == CLIP_POWUP_SHIELD)
+            player.max_shield += 1000;
+        else if (e.type == EVENT_PICKUP)
+        {
+            player.powerup_cd = 6;
+            player.weapon++;
+        }
+    }
+    event_check_lapped(gameplay_events, lost, "gameplay");
+    playerdamage(player, damage);
+}
+
+void score_consume()
+{
+    uint64_t lost = score_events.lost;
+    event_t e;
+    while (event_next(score_events, e))
+        if (e.type == EVENT_KILL)
+            game.highscore += e.value;
+    event_check_lapped(score_events, lost, "score");
+}
+
+void fx_consume()
+{
+    const clip_t &clip = game.clips[CLIP_EXPLOSION2];
+    event_t e;
+    while (event_next(fx_events, e))
+        if (e.type == EVENT_HIT && governor_admit_explosion())
+            game.explosions.push_back(animation_start(CLIP_EXPLOSION2, {e.pos.x - clip.width / 2, e.pos.y - clip.height / 2}, game.gametime));
+}
+
+// once per rendered frame, before audio_flush()
+void audio_consume()
+{
+    event_t e;
+    while (event_next(audio_events, e))
+    {
+        if (e.type == EVENT_HIT)
+            play_sound(SFX_EXPLOSION);
+        else if (e.type == EVENT_SPAWN && (e.kind == PROJECTILES || e.kind == ENEMYPROJECTILES))
+            play_sound(SFX_GUN);
+    }
+}
+
+// one fixed tick of the game simulation, game.delta is always game.sim_dt here
+void mainloop_step()
+{
+    TRACE_ZONE("mainloop_step");
+    sim_store_prev();
+
+    // update times
+    game.gametime += game.delta;
+    // update_game. the four movers touch one pool each and run side by side,
+    // collisions touch everything and publish what hit what. after it the
+    // ship, the explosions, the powerups and the score are independent again,
+    // each reading the events it cares about. every stage does the same work in the
+    // same order as serially, so replays match for any thread count
+    auto enemies = []()
+    {
+        enemy_update(game.enemies);
+    };
+    auto asteroids = []()
+    {
+        asteroids_update(game.asteroids);
+    };
+    auto projectiles = []()
+    {
+        projectiles_update(game.projectiles);
+    };
+    auto enemy_projectiles = []()
+    {
+        projectiles_update(game.enemy_projectiles);
+    };
+    auto collisions = []()
+    {
+        collision_handler(game.projectiles, game.asteroids, game.enemies, game.var.ship, game.enemy_projectiles, game.powerups);
+    };
+    auto ship = []()
+    {
+        gameplay_consume(game.var.ship);
+        playerinput_handler(game.var.ship, game.inputs);
+        game.last_inputs = game.inputs;
+        shieldrecover(game.var.ship);
+    };
+    auto explosions = []()
+    {
+        fx_consume();
+        animations_update(game.explosions, game.gametime);
+    };
+    auto score = []()
+    {
+        score_consume();
+    };
+    auto powerups = []()
+    {
+        animations_update(game.powerups, game.gametime);
+        for (size_t i = 0; i < game.powerups.size(); i++)
+            update_pos(game.powerups[i].position, {game.powerups[i].position.x, (float)game.window_height + 10}, 100);
+    };
+
+    job_graph_t graph;
+    int movers[] = {graph.add(enemies), graph.add(asteroids), graph.add(projectiles), graph.add(enemy_projectiles)};
+    int collide = graph.add(collisions);
+    for (int mover : movers)
+        graph.after(collide, mover);
+    graph.after(graph.add(ship), collide);
+    graph.after(graph.add(explosions), collide);
+    graph.after(graph.add(powerups), collide);
+    graph.after(graph.add(score), collide);
+    graph.run();
+
+    uint64_t spawner_begin = trace_now();
+    // RANDOM SPAWN TIME!!!!
+    if (game.gametime - game.spawner.event_timer > 1)
+    {
+        game.spawner.event_timer = game.gametime;
+        if(game.var.ship.powerup_cd > 0)
+            game.var.ship.powerup_cd -= 1;
+
+        if (game.var.ship.powerup_cd == 0)
+            game.var.ship.weapon = 0;
+
+        int enemyshoot = game.rng.event.range(40);
+        if (game.enemies.size() > 0 && game.enemies.size() > enemyshoot)
+        {
+            game.var.enemy_attack.pos = game.enemies[enemyshoot].pos;
+            Vector2 diff = Vector2Subtract(game.var.ship.pos, game.enemies[enemyshoot].pos);
+            game.var.enemy_attack.direction = Vector2Normalize(diff);
+
+            game.enemy_projectiles.push_back(game.var.enemy_attack);
+            event_publish(EVENT_SPAWN, ENEMYPROJECTILES, 1, game.var.enemy_attack.pos);
+        }
+
+        int powerup = -1;
+        if(enemyshoot == 1 || enemyshoot == 40)
+            powerup = CLIP_POWUP_LIFE;
+        else if (enemyshoot == 2|| enemyshoot == 20)
+            powerup = CLIP_POWUP_SHIELD;
+        else if (enemyshoot == 3|| enemyshoot == 30)
+            powerup = CLIP_POWUP_WEAPON;
+        // a level brings its own powerups
+        if (powerup >= 0 && !level.header)
+        {
+            Vector2 position = {(float)game.rng.event.range(game.window_width), 0};
+            game.powerups.push_back(animation_start((_CLIP)powerup, position, game.gametime));
+            event_publish(EVENT_SPAWN, CONTAINERS, 1, position, powerup);
+        }
+    }
+
+    // spawntime!
+    if (level.header)
+        level_spawn();
+    else if (game.gametime - game.spawner.asteroid_spawntimer > 0.3)
+    {
+        game.spawner.asteroid_spawntimer = game.gametime;
+        int spawns = governor_admit_asteroids(game.spawner.asteroid_spawns);
+        asteroids_spawn(game.asteroids, &game.textures.asteroid_textures[game.rng.spawn.range(game.textures.asteroid_textures.size())], spawns);
+        // nothing to tell when the governor turned them all away
+        if (spawns > 0)
+            event_publish(EVENT_SPAWN, ASTEROIDS, spawns, {0, 0});
+    }
+    if (!level.header && game.gametime - game.spawner.enemy_spawntimer > game.spawner.enemy_spawnspeed * governor_enemy_scale())
+    {
+        game.spawner.enemy_spawntimer = game.gametime;
+        if (game.spawner.enemy_spawner-- > 0)
+        {
+            game.enemies.push_back(game.var.enemy);
+            event_publish(EVENT_SPAWN, ENEMIES, 1, game.var.enemy.pos);
         }
-        else
-            speed = 300;
 
-        if (destination != game.ship_startpos)
+        else if (game.enemies.size() == 0)
         {
-            animation_play(game.animations.boost);
-            game.animations.boost.position = {game.var.ship.pos.x - game.animations.boost.framerec.width / 2, game.var.ship.pos.y + game.var.ship.texture->height / 2};
+            game.var.enemy.speed += 40;
+            game.var.enemy.path_origin.x = game.rng.spawn.range(screenWidth);
+            game.var.enemy.path_seed = ((uint64_t)game.rng.enemy.next() << 32) | game.rng.enemy.next();
+
+            game.spawner.enemy_spawner = game.rng.spawn.range(10);
+            // floored, otherwise it shrinks toward zero and long sessions spawn every tick
+            game.spawner.enemy_spawnspeed = fmax(game.spawner.enemy_spawnspeed * 0.92, 0.1);
+            game.spawner.asteroid_spawns += game.rng.spawn.range(2);
         }
-
-        BeginDrawing();
-        ClearBackground(BLACK);
-        DrawTextureEx(game.textures.bg_tex, {-20, -game.bg_scrollpos}, 0, 2, WHITE);
-        DrawTextureEx(game.textures.bg_tex, {20, -game.textures.bg_tex.height * 2 - game.bg_scrollpos}, 0, 2, RAYWHITE);
-        DrawTexture(*game.var.ship.texture, game.var.ship.pos.x - game.var.ship.texture->width / 2, game.var.ship.pos.y - game.var.ship.texture->height / 2, WHITE);
-        if (destination != game.ship_startpos)
-            DrawTextureRec(*game.animations.boost.texture, game.animations.boost.framerec, game.animations.boost.position, WHITE);
-        EndDrawing();
     }
+    uint64_t spawner_end = trace_now();
+    trace_record("spawner", spawner_begin, spawner_end);
+    hud.stage_ns[STAGE_SPAWNER] += spawner_end - spawner_begin;
 }
 
-void mainloop()
+// feeds one rendered frame into the fixed step loop
+void sim_advance(float frametime)
 {
+    TRACE_STAGE("sim_advance", STAGE_SIM);
+    // clamp hitches so a stalled frame can't queue up seconds of sim steps
+    if (frametime > 0.25f)
+        frametime = 0.25f;
+    game.sim_accumulator += frametime;
+
+    game.delta = game.sim_dt;
+    while (game.sim_accumulator >= game.sim_dt)
+    {
+        game.sim_accumulator -= game.sim_dt;
+        uint64_t step_begin = trace_now();
+        mainloop_step();
+        governor.step_ms = governor.step_ms * 0.9f + (trace_now() - step_begin) / 1e6f * 0.1f;
+        if (game.var.ship.hp <= 0)
+            break;
+    }
+}
 
+void mainloop_init()
+{
     game.explosions.clear();
     game.asteroids.clear();
     game.projectiles.clear();
     game.enemy_projectiles.clear();
     game.enemies.clear();
-    int enemy_spawner = 10;
-    double asteroid_spawntimer = 0;
-    double enemy_spawntimer = 2;
-    int asteroid_spawns = 1;
-    double enemy_spawnspeed = 1;
+    game.powerups.clear();
+    game.autopilot_target = handle_none;
+    game.spawner.enemy_spawner = 10;
+    game.spawner.asteroid_spawntimer = 0;
+    game.spawner.enemy_spawntimer = 2;
+    game.spawner.asteroid_spawns = 1;
+    game.spawner.enemy_spawnspeed = 1;
+    game.spawner.event_timer = 0;
     game.var.enemy.speed = 250;
+    game.var.enemy.path_origin = game.var.enemy.pos;
+    game.var.enemy.path_seed = ((uint64_t)game.rng.enemy.next() << 32) | game.rng.enemy.next();
 
     game.var.ship.pos = game.ship_startpos;
+    game.var.ship.prev_pos = game.ship_startpos;
+    game.var.ship.max_hp = game.var.ship.base_hp;
+    game.var.ship.max_shield = game.var.ship.base_shield;
     game.var.ship.hp = game.var.ship.max_hp;
     game.var.ship.shield = game.var.ship.max_shield;
+    game.var.ship.speed = game.var.ship.base_speed;
+    game.var.ship.weapon = 0;
+    game.var.ship.powerup_cd = 0;
+    game.var.ship.last_hit = 0;
+    game.var.ship.shield_hit = 0;
+    game.var.ship.last_shield = game.var.ship.max_shield;
+    game.var.ship.last_hp = game.var.ship.max_hp;
     game.gametime = 0;
     game.var.ship.last_shot = 0;
     game.highscore = 0;
+    game.sim_accumulator = 0;
+    game.inputs = 0;
+    game.last_inputs = 0;
+    event_subscribe(gameplay_events);
+    event_subscribe(score_events);
+    event_subscribe(fx_events);
+    governor_reset();
+    level_reset();
+}
 
-    SeekMusicStream(game.sound.bg_music, 0);
-    PlayMusicStream(game.sound.bg_music);
+// what the render thread needs of one sim step. sprites and clips are loaded
+// once and never change, so items can point at them
+struct render_item_t
+{
+    // nullptr for animations, which draw from clip and frame instead
+    const sprite_t *sprite;
+    uint16_t clip;
+    uint16_t frame;
+    Vector2 prev;
+    Vector2 pos;
+};
 
-    //game.powerups.push_back(game.animations.powup_life);
-    //game.powerups.push_back(game.animations.powup_shield);
-    //game.powerups.push_back(game.animations.powup_weapon);
-    float event_timer = 0;
+struct render_snapshot_t
+{
+    std::vector<render_item_t> items;
+    // items before this index are drawn below the ship
+    size_t ship_layer = 0;
+    Vector2 ship_prev;
+    Vector2 ship_pos;
+    const sprite_t *ship_sprite = nullptr;
+    int hp, max_hp;
+    int shield, max_shield;
+    bool pause = false;
+    sim_stats_t stats;
+    // trace_now() at publish, the render thread interpolates from here
+    uint64_t time = 0;
+};
 
-    while (!WindowShouldClose())
+// triple buffer between the sim and the render thread. the sim owns back, the
+// render thread owns front, middle is swapped in and out atomically. the fresh
+// bit on middle tells the reader a new snapshot is waiting
+const uint32_t RENDER_FRESH = 4;
+
+struct
+{
+    render_snapshot_t buffers[3];
+    std::atomic<uint32_t> middle{1};
+    uint32_t back = 0;
+    uint32_t front = 2;
+} render;
+
+void render_reserve(size_t items)
+{
+    for (auto &buffer : render.buffers)
+        buffer.items.reserve(items);
+}
+
+// sim thread, after each advance
+void render_publish()
+{
+    TRACE_ZONE("render_publish");
+    render_snapshot_t &snap = render.buffers[render.back];
+    snap.items.clear();
+    for (size_t i = 0; i < game.asteroids.size(); i++)
+        snap.items.push_back({game.asteroids.sprite[i], 0, 0, game.asteroids.prev_pos(i), game.asteroids.pos(i)});
+    for (size_t i = 0; i < game.enemies.size(); i++)
+        snap.items.push_back({game.enemies[i].sprite, 0, 0, game.enemies[i].prev_pos, game.enemies[i].pos});
+    for (size_t i = 0; i < game.projectiles.size(); i++)
+        snap.items.push_back({game.projectiles.sprite[i], 0, 0, game.projectiles.prev_pos(i), game.projectiles.pos(i)});
+    for (size_t i = 0; i < game.enemy_projectiles.size(); i++)
+        snap.items.push_back({game.enemy_projectiles.sprite[i], 0, 0, game.enemy_projectiles.prev_pos(i), game.enemy_projectiles.pos(i)});
+    snap.ship_layer = snap.items.size();
+    for (size_t i = 0; i < game.powerups.size(); i++)
+        snap.items.push_back({nullptr, game.powerups[i].clip, game.powerups[i].frame, game.powerups[i].prev_position, game.powerups[i].position});
+    for (size_t i = 0; i < game.explosions.size(); i++)
+        snap.items.push_back({nullptr, game.explosions[i].clip, game.explosions[i].frame, game.explosions[i].position, game.explosions[i].position});
+
+    snap.ship_prev = game.var.ship.prev_pos;
+    snap.ship_pos = game.var.ship.pos;
+    snap.ship_sprite = game.var.ship.sprite;
+    snap.hp = game.var.ship.hp;
+    snap.max_hp = game.var.ship.max_hp;
+    snap.shield = game.var.ship.shield;
+    snap.max_shield = game.var.ship.max_shield;
+    snap.pause = game.pause;
+    snap.stats = sim_stats();
+    snap.time = trace_now();
+
+    render.back = render.middle.exchange(render.back | RENDER_FRESH, std::memory_order_acq_rel) & 3;
+}
+
+// render thread, takes the newest snapshot if there is one, else keeps the last
+const render_snapshot_t &render_latest()
+{
+    if (render.middle.load(std::memory_order_relaxed) & RENDER_FRESH)
+        render.front = render.middle.exchange(render.front, std::memory_order_acq_rel) & 3;
+    return render.buffers[render.front];
+}
+
+void DrawRenderItem(const render_item_t &item, float alpha)
+{
+    Vector2 pos = Vector2Lerp(item.prev, item.pos, alpha);
+    if (item.sprite)
     {
-        if (game.var.ship.hp <= 0)
-            return;
+        DrawSprite(*item.sprite, pos, WHITE);
+        return;
+    }
+    const clip_t &clip = game.clips[item.clip];
+    DrawSpriteRec(*clip.sprite, clip.frames[item.frame], pos, WHITE);
+}
 
-        if (IsKeyPressed(KEY_P))
-            game.pause = game.pause ? false : true;
+// the sim runs on its own thread while a session is played. the main thread
+// keeps raylib to itself: it pumps input into these atomics and draws the
+// snapshots the sim publishes
+struct
+{
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> done{false};
+    std::atomic<bool> pause{false};
+    std::atomic<bool> weapon_cheat{false};
+    std::atomic<uint8_t> inputs{0};
+} sim_thread;
+
+void sim_thread_main()
+{
+    alloc_game_thread = true;
+    trace_thread_name("sim");
+    auto last = std::chrono::steady_clock::now();
+    while (sim_thread.running)
+    {
+        TRACE_ZONE("sim_frame");
+        frame_arena.reset();
+        auto now = std::chrono::steady_clock::now();
+        float frametime = std::chrono::duration<float>(now - last).count();
+        last = now;
 
+        game.pause = sim_thread.pause;
         if (!game.pause)
         {
-            UpdateMusicStream(game.sound.bg_music);
-            // fire events!
-            for (auto e : game.collisions)
+            if (sim_thread.weapon_cheat.exchange(false))
+                game.var.ship.weapon = (game.var.ship.weapon + 1) % 2;
+
+            // input and load level are sampled once per sim frame and held for all steps of that frame
+            if (!replay.playing)
+                governor_update();
+            game.inputs = game.autopilot ? autopilot_inputs() : sim_thread.inputs.load();
+            if (replay.playing && !replay_next(frametime, game.inputs, governor.level))
             {
-                game.animations.explosion2.position = {e.x - game.animations.explosion2.framerec.width / 2, e.y - game.animations.explosion2.framerec.height / 2};
-                game.explosions.push_back(game.animations.explosion2);
-                PlaySound(game.sound.explosion_sound);
+                sim_thread.done = true;
+                break;
             }
-            game.collisions.clear();
-
-            // update times
-            game.delta = GetFrameTime();
-            game.gametime += game.delta;
-            // update_game
-            enemy_update(game.enemies);
-            asteroids_update(game.asteroids);
-            projectiles_update(game.projectiles);
-            projectiles_update(game.enemy_projectiles);
-            collision_handler(game.projectiles, game.asteroids, game.enemies, game.var.ship, game.enemy_projectiles, game.powerups);
-            playerinput_handler(game.var.ship);
-            shieldrecover(game.var.ship);
-            animations_update(game.explosions);
-            animations_update(game.powerups);
-
-            for (int i = 0; i < game.powerups.size(); i++)
-                update_pos(game.powerups[i].position, {game.powerups[i].position.x, (float)game.window_height + 10}, 100);
-
-            // RANDOM SPAWN TIME!!!!
-            if (game.gametime - event_timer > 1)
-            {
-                event_timer = game.gametime;
-                if(game.var.ship.powerup_cd > 0)
-                    game.var.ship.powerup_cd -= 1;
+            if (replay.recording)
+                replay_write(frametime, game.inputs, governor.level);
 
-                if (game.var.ship.powerup_cd == 0)
-                    game.var.ship.weapon = 0;
+            sim_advance(frametime);
+        }
+        render_publish();
+        if (game.var.ship.hp <= 0)
+        {
+            sim_thread.done = true;
+            break;
+        }
 
-                int enemyshoot = rand() % (40);
-                if (game.enemies.size() > 0 && game.enemies.size() > enemyshoot)
-                {
-                    game.var.enemy_attack.pos = game.enemies[enemyshoot].pos;
-                    Vector2 diff = Vector2Subtract(game.var.ship.pos, game.enemies[enemyshoot].pos);
-                    game.var.enemy_attack.direction = Vector2Normalize(diff);
+        // sleep until the next step is due. a replay sleeps for the recorded
+        // frame instead, so it plays back at the speed it was recorded
+        float wait = replay.playing ? frametime : game.sim_dt - (float)game.sim_accumulator;
+        if (game.pause)
+            wait = game.sim_dt;
+        std::this_thread::sleep_until(now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(std::max(wait, 0.0f))));
+    }
+}
 
-                    game.enemy_projectiles.push_back(game.var.enemy_attack);
-                    PlaySound(game.sound.gunloop_sound);
-                }
+void mainloop()
+{
+    mainloop_init();
 
-                if(enemyshoot == 1 || enemyshoot == 40)
-                {
-                    game.animations.powup_life.position = {(float)(rand()%game.window_width), 0};
-                    game.powerups.push_back(game.animations.powup_life);
-                }
-                else if (enemyshoot == 2|| enemyshoot == 20)
-                {
-                    game.animations.powup_shield.position = {(float)(rand()%game.window_width), 0};
-                    game.powerups.push_back(game.animations.powup_shield);
-                }
-                else if (enemyshoot == 3|| enemyshoot == 30)
-                {
-                    game.animations.powup_weapon.position = {(float)(rand()%game.window_width), 0};
-                    game.powerups.push_back(game.animations.powup_weapon);
-                }
-            }
+    SeekMusicStream(game.sound.bg_music, 0);
+    PlayMusicStream(game.sound.bg_music);
 
-            // spawntime!
-            if (game.gametime - asteroid_spawntimer > 0.3)
-            {
-                asteroid_spawntimer = game.gametime;
-                asteroids_spawn(game.asteroids, &game.textures.asteroid_textures[rand() % game.textures.asteroid_textures.size()], asteroid_spawns);
-            }
-            if (game.gametime - enemy_spawntimer > enemy_spawnspeed)
-            {
-                enemy_spawntimer = game.gametime;
-                if (enemy_spawner-- > 0)
-                    game.enemies.push_back(game.var.enemy);
+    //game.powerups.push_back(game.animations.powup_life);
+    //game.powerups.push_back(game.animations.powup_shield);
+    //game.powerups.push_back(game.animations.powup_weapon);
 
-                else if (game.enemies.size() == 0)
-                {
-                    game.var.enemy.speed += 40;
-                    Vector2 spawnpos = game.var.enemy_path[0];
-                    spawnpos.x = rand() % screenWidth;
-                    game.var.enemy_path.clear();
-                    game.var.enemy_path.push_back(spawnpos);
-
-                    enemy_spawner = rand() % 10;
-                    enemy_spawnspeed -= enemy_spawnspeed * 0.08;
-                    asteroid_spawns += rand() % 2;
-                }
-            }
+    // the first frame draws before the sim thread has stepped
+    render_publish();
+    event_subscribe(audio_events);
+    sim_thread.done = false;
+    sim_thread.pause = false;
+    sim_thread.weapon_cheat = false;
+    sim_thread.inputs = 0;
+    sim_thread.running = true;
+    sim_thread.thread = std::thread(sim_thread_main);
+
+    while (!WindowShouldClose() && !sim_thread.done)
+    {
+        TRACE_ZONE("mainloop");
+        trace_hotkey();
+        audio_consume();
+        audio_flush();
+        if (IsKeyPressed(KEY_P))
+            sim_thread.pause = !sim_thread.pause;
 
-            if (game.bg_scrollpos -= game.delta * game.bg_scollspeed, game.bg_scrollpos <= -game.textures.bg_tex.height * 2)
-                game.bg_scrollpos = 0;
+        if (!sim_thread.pause)
+        {
+            {
+                TRACE_ZONE("UpdateMusicStream");
+                UpdateMusicStream(game.sound.bg_music);
+            }
+            // the weapon cheat isn't part of the input mask, so it would break replays
+            if (IsKeyPressed(KEY_I) && !replay.recording && !replay.playing)
+                sim_thread.weapon_cheat = true;
+            sim_thread.inputs = read_inputs();
+            background_update(GetFrameTime());
         }
 
+        const render_snapshot_t &snap = render_latest();
+        float frame_ms = governor.frame_ms.load(std::memory_order_relaxed);
+        governor.frame_ms.store(frame_ms * 0.9f + GetFrameTime() * 1000 * 0.1f, std::memory_order_relaxed);
+        float alpha = Clamp((trace_now() - snap.time) / 1e9f / game.sim_dt, 0, 1);
+
+        uint64_t draw_begin = trace_now();
         BeginDrawing();
         ClearBackground(BLACK);
 
         // Draw background
-        DrawTextureEx(game.textures.bg_tex, {-20, -game.bg_scrollpos}, 0, 2, WHITE);
-        DrawTextureEx(game.textures.bg_tex, {20, -game.textures.bg_tex.height * 2 - game.bg_scrollpos}, 0, 2, RAYWHITE);
+        background_draw(governor_background_layers(snap.stats.load_level));
 
-        // Draw asteroids
-        for (int i = 0; i < game.asteroids.size(); i++)
-            DrawTexture(*game.asteroids[i].texture, game.asteroids[i].pos.x, game.asteroids[i].pos.y, WHITE);
-
-        // Draw enemies
-        for (int i = 0; i < game.enemies.size(); i++)
-            DrawTexture(*game.enemies[i].texture, game.enemies[i].pos.x, game.enemies[i].pos.y, WHITE);
-
-        // Draw projectiles
-        for (int i = 0; i < game.projectiles.size(); i++)
-            DrawTexture(*game.projectiles[i].texture, game.projectiles[i].pos.x, game.projectiles[i].pos.y, WHITE);
-        for (int i = 0; i < game.enemy_projectiles.size(); i++)
-            DrawTexture(*game.enemy_projectiles[i].texture, game.enemy_projectiles[i].pos.x, game.enemy_projectiles[i].pos.y, WHITE);
+        // Draw asteroids, enemies and projectiles
+        for (size_t i = 0; i < snap.ship_layer; i++)
+            DrawRenderItem(snap.items[i], alpha);
 
         // Draw the spaceship
-        DrawTexture(*game.var.ship.texture, game.var.ship.pos.x - game.var.ship.texture->width / 2, game.var.ship.pos.y - game.var.ship.texture->height / 2, WHITE);
-        if (game.var.ship.shield > 0)
-            DrawTexture(game.textures.shield_tex, game.var.ship.pos.x - game.textures.shield_tex.width / 2, game.var.ship.pos.y - game.textures.shield_tex.height / 2, WHITE);
+        Vector2 ship_pos = Vector2Lerp(snap.ship_prev, snap.ship_pos, alpha);
+        DrawSprite(*snap.ship_sprite, {ship_pos.x - snap.ship_sprite->width / 2, ship_pos.y - snap.ship_sprite->height / 2}, WHITE);
+        if (snap.shield > 0)
+            DrawSprite(game.textures.shield_tex, {ship_pos.x - game.textures.shield_tex.width / 2, ship_pos.y - game.textures.shield_tex.height / 2}, WHITE);
 
-        for (int i = 0; i < game.powerups.size(); i++)
-            DrawAnimation(game.powerups[i]);
-
-        // Draw animations
-        for (int i = 0; i < game.explosions.size(); i++)
-            DrawAnimation(game.explosions[i]);
-        // DrawTextureRec(*game.explosions[i].texture, game.explosions[i].framerec, game.explosions[i].position, WHITE);
+        // Draw powerups and explosions
+        for (size_t i = snap.ship_layer; i < snap.items.size(); i++)
+            DrawRenderItem(snap.items[i], alpha);
 
         // auto s_hp = "HP: " + std::to_string(game.var.ship.hp);
         // auto s_shield = "Shield: " + std::to_string(game.var.ship.shield);
         // DrawText(h_size.c_str(), screenWidth / 3, 10, 20, RED);
-        DrawTextEx(font, TextFormat("Score: %d", game.highscore), {screenWidth / 3, 10}, 20, 1, RED);
+        const char *score = TextFormat("Score: %d", snap.stats.score);
+        DrawTextEx(font, score, {screenWidth / 3, 10}, 20, 1, RED);
+        render_count(font.texture, strlen(score));
         // DrawText(s_hp.c_str(), 10, 10, 20, RED);
         // DrawText(s_shield.c_str(), 10, 40, 20, RED);
-        DrawShieldbar({(float)game.textures.ui_bar_b.width / 2, 0}, (float)game.var.ship.shield / game.var.ship.max_shield);
-        DrawHealthbar({(float)game.textures.ui_bar_b.width / 2, (float)game.textures.ui_bar_red.height * 0.7f}, (float)game.var.ship.hp / game.var.ship.max_hp);
-        if (game.pause)
+        DrawShieldbar({(float)game.textures.ui_bar_b.width / 2, 0}, (float)snap.shield / snap.max_shield);
+        DrawHealthbar({(float)game.textures.ui_bar_b.width / 2, (float)game.textures.ui_bar_red.height * 0.7f}, (float)snap.hp / snap.max_hp);
+        if (snap.pause)
         {
             // DrawText("P A U S E", screenWidth / 2 - screenWidth * 0.1, screenHeight / 2, 40, WHITE);
             DrawTextEx(font, "P A U S E", {screenWidth / 2 - screenWidth * 0.1, screenHeight / 2}, 40, 1, WHITE);
+            render_count(font.texture, 9);
             // DrawTextEx(font , "    EXIT   ", {exit_pos.x, exit_pos.y}, textsize, 5.5, title);
         }
 
-        EndDrawing();
+        hud_draw(snap.stats);
+
+        uint64_t draw_end = trace_now();
+        trace_record("draw", draw_begin, draw_end);
+        hud.stage_ns[STAGE_DRAW] += draw_end - draw_begin;
+        {
+            TRACE_ZONE("EndDrawing");
+            EndDrawing();
+        }
+        hud_frame_end(GetFrameTime());
+        metrics_publish(GetFrameTime(), snap.stats);
     }
 
+    sim_thread.running = false;
+    sim_thread.thread.join();
     StopMusicStream(game.sound.bg_music);
 }
 
 void gameover()
 {
-    std::vector<animation_t> animations;
-    animations.reserve(12);
+    pool_t<animation_t> animations;
+    animations.reserve(64);
     float height = game.window_height;
     float width = game.window_width;
     std::vector<Vector2> pos = {{width / 2, height / 2}};
@@ -1053,9 +5030,13 @@ void gameover()
 
     while (!WindowShouldClose())
     {
-        if (game.bg_scrollpos -= game.delta * game.bg_scollspeed, game.bg_scrollpos <= -game.textures.bg_tex.height * 2)
-            game.bg_scrollpos = 0;
+        TRACE_ZONE("gameover");
+        // animations_update() takes its scratch from the frame arena
+        frame_arena.reset();
+        trace_hotkey();
+        audio_flush();
         game.delta = GetFrameTime();
+        background_update(game.delta);
         game.gametime += game.delta;
         if (update_pos(game.var.ship.pos, pos[pos_pos], 100))
             reached = true;
@@ -1063,19 +5044,21 @@ void gameover()
         if (!reached && game.gametime - timestamp > 0.2f)
         {
             timestamp = game.gametime;
-            game.animations.explosion2.position = {(game.var.ship.pos.x - game.animations.explosion2.framerec.width / 2) + (rand() % game.var.ship.texture->width - game.var.ship.texture->width / 2), (game.var.ship.pos.y - game.animations.explosion2.framerec.height / 2) + (rand() % game.var.ship.texture->height - game.var.ship.texture->height / 2)};
-            animations.push_back(game.animations.explosion2);
-            PlaySound(game.sound.explosion_sound);
+            const clip_t &clip = game.clips[CLIP_EXPLOSION2];
+            Vector2 position = {(game.var.ship.pos.x - clip.width / 2) + (rand() % game.var.ship.sprite->width - game.var.ship.sprite->width / 2), (game.var.ship.pos.y - clip.height / 2) + (rand() % game.var.ship.sprite->height - game.var.ship.sprite->height / 2)};
+            animations.push_back(animation_start(CLIP_EXPLOSION2, position, game.gametime));
+            play_sound(SFX_EXPLOSION);
         }
 
         if (reached && game.var.ship.pos != Vector2{width / 2, height + 100})
         {
-            game.animations.big_boom.position = {(game.var.ship.pos.x - game.animations.big_boom.framerec.width / 2), (game.var.ship.pos.y - game.animations.big_boom.framerec.width / 2)};
+            const clip_t &clip = game.clips[CLIP_BIG_BOOM];
+            Vector2 position = {(game.var.ship.pos.x - clip.width / 2), (game.var.ship.pos.y - clip.width / 2)};
             game.var.ship.pos = {width / 2, height + 100};
             pos.clear();
             pos.push_back({width / 2, height + 100});
-            animations.push_back(game.animations.big_boom);
-            PlaySound(game.sound.explosion_sound);
+            animations.push_back(animation_start(CLIP_BIG_BOOM, position, game.gametime));
+            play_sound(SFX_EXPLOSION);
         }
 
         if (reached && opa < 0.9)
@@ -1090,19 +5073,18 @@ void gameover()
         if (reached && IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
             return;
 
-        animations_update(animations);
+        animations_update(animations, game.gametime);
         text_color = ColorFromHSV(hue, 0.8f, opa);
 
         BeginDrawing();
         ClearBackground(BLACK);
-        DrawTextureEx(game.textures.bg_tex, {-20, -game.bg_scrollpos}, 0, 2, WHITE);
-        DrawTextureEx(game.textures.bg_tex, {20, -game.textures.bg_tex.height * 2 - game.bg_scrollpos}, 0, 2, RAYWHITE);
+        background_draw();
 
-        DrawTexture(*game.var.ship.texture, game.var.ship.pos.x - game.var.ship.texture->width / 2, game.var.ship.pos.y - game.var.ship.texture->height / 2, WHITE);
+        DrawSprite(*game.var.ship.sprite, {game.var.ship.pos.x - game.var.ship.sprite->width / 2, game.var.ship.pos.y - game.var.ship.sprite->height / 2}, WHITE);
         // Draw animations
         for (int i = 0; i < animations.size(); i++)
         {
-            DrawTextureRec(*animations[i].texture, animations[i].framerec, animations[i].position, WHITE);
+            DrawAnimation(animations[i]);
         }
 
         if (reached)
@@ -1118,248 +5100,815 @@ void gameover()
     animations.clear();
 }
 
-void init_assets()
+struct script_t
+{
+    int tick;
+    uint8_t inputs;
+};
+
+// scripted input for headless runs, every line is "<tick> <inputmask>" and holds until the next line
+bool load_input_script(std::vector<script_t> &script, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        printf("couldnt open input script %s\n", path);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '#')
+            continue;
+        char *end;
+        long tick = strtol(line, &end, 0);
+        if (end == line)
+            continue;
+        script.push_back((script_t){(int)tick, (uint8_t)strtol(end, nullptr, 0)});
+    }
+    fclose(file);
+    return true;
+}
+
+uint8_t script_inputs(const std::vector<script_t> &script, int tick, size_t &cursor)
+{
+    // no script: weave left and right once per second while holding fire
+    if (script.empty())
+        return INPUT_SHOOT | ((tick / game.sim_hz) % 2 ? INPUT_LEFT : INPUT_RIGHT);
+
+    while (cursor + 1 < script.size() && script[cursor + 1].tick <= tick)
+        cursor++;
+    return script[cursor].tick <= tick ? script[cursor].inputs : 0;
+}
+
+// runs the mainloop() update pipeline without window, renderer or audio.
+// with --replay the recorded frames are fed in, with --record the run is saved
+int headless_run(int ticks, const char *script_path)
+{
+    std::vector<script_t> script;
+    if (script_path && !load_input_script(script, script_path))
+        return 1;
+
+    replay_session_begin();
+    mainloop_init();
+    game.delta = game.sim_dt;
+    // a replay brings its own frame times, so ticks are frames here
+    if (replay.playing)
+        ticks = replay.frames.size();
+
+    size_t cursor = 0;
+    int sessions = 1;
+    double total_us = 0;
+    double max_us = 0;
+    for (int tick = 0; tick < ticks; tick++)
+    {
+        frame_arena.reset();
+        float frametime = game.sim_dt;
+        if (replay.playing)
+            replay_next(frametime, game.inputs, governor.level);
+        else
+        {
+            governor_update();
+            game.inputs = game.autopilot ? autopilot_inputs() : script_inputs(script, tick, cursor);
+        }
+        if (replay.recording)
+            replay_write(frametime, game.inputs, governor.level);
+
+        auto start = std::chrono::steady_clock::now();
+        sim_advance(frametime);
+        auto end = std::chrono::steady_clock::now();
+
+        double us = std::chrono::duration<double, std::micro>(end - start).count();
+        total_us += us;
+        if (us > max_us)
+            max_us = us;
+        hud_frame_end(us / 1e6f);
+        metrics_publish(us / 1e6f, sim_stats());
+        printf("tick %d %.2f us asteroids %zu projectiles %zu enemy_projectiles %zu enemies %zu explosions %zu powerups %zu\n", tick, us,
+               game.asteroids.size(), game.projectiles.size(), game.enemy_projectiles.size(), game.enemies.size(), game.explosions.size(), game.powerups.size());
+
+        // keep soaking after the ship dies
+        if (game.var.ship.hp <= 0)
+        {
+            printf("session %d over at tick %d score %u\n", sessions++, tick, game.highscore);
+            mainloop_init();
+        }
+    }
+
+    printf("%d ticks at %d Hz, %d sessions, total %.2f ms, mean %.2f us, max %.2f us\n", ticks, game.sim_hz, sessions, total_us / 1000, ticks ? total_us / ticks : 0, max_us);
+    return replay_session_end() ? 0 : 1;
+}
+
+// runs the default headless script and fails if the main thread or a job
+// worker allocates after warm-up. sessions restart like in --headless and
+// every tick is sent through multi_send(), so both are covered
+int alloc_check(int ticks)
+{
+    const int warmup = 2 * game.sim_hz;
+    std::vector<script_t> script;
+    size_t cursor = 0;
+    uint64_t allocs = 0;
+    uint64_t bytes = 0;
+
+    mainloop_init();
+    game.delta = game.sim_dt;
+    for (int tick = 0; tick < warmup + ticks; tick++)
+    {
+        frame_arena.reset();
+        if (tick == warmup)
+        {
+            alloc_zones_reset();
+            allocs = alloc_stats.game;
+            bytes = alloc_stats.bytes;
+        }
+        game.inputs = script_inputs(script, tick, cursor);
+        sim_advance(game.sim_dt);
+        multi_send();
+        multi_ack(game.net.tick - 1);
+        hud_frame_end(game.sim_dt);
+        metrics_publish(game.sim_dt, sim_stats());
+        if (game.var.ship.hp <= 0)
+            mainloop_init();
+    }
+    allocs = alloc_stats.game - allocs;
+    bytes = alloc_stats.bytes - bytes;
+
+    for (int i = 0; i < alloc_stats.used; i++)
+        if (alloc_stats.zones[i].count)
+            printf("%-24s %8llu allocations\n", alloc_stats.zones[i].name, (unsigned long long)alloc_stats.zones[i].count);
+    printf("%d ticks after %d warm-up: %llu allocations on the game threads, %llu bytes process wide\n", ticks, warmup, (unsigned long long)allocs, (unsigned long long)bytes);
+    return allocs ? 1 : 0;
+}
+
+// hours of sim time on the autopilot. every SOAK_INTERVAL sim seconds it
+// prints RSS, pool sizes, tick time percentiles and the game threads
+// allocation count, at the end it flags every series that kept rising
+#define SOAK_INTERVAL 60
+#define SOAK_SERIES 9
+// kendall tau over the samples, 1 is strictly rising
+#define SOAK_TREND 0.6f
+
+// skips the first sample, which is warm-up. per session sawtooth and noise
+// have no trend, a leak rises against almost every earlier sample
+bool soak_growing(const std::vector<float> &samples, float &from, float &to)
 {
-    game.textures.bg_tex = LoadTexture("assets/background/spr_stars02.png");
+    size_t n = samples.size() - 1;
+    if (samples.size() < 9)
+        return false;
+    const float *s = samples.data() + 1;
+    long score = 0;
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = i + 1; j < n; j++)
+            score += (s[j] > s[i]) - (s[j] < s[i]);
+    float tau = score / (n * (n - 1) / 2.0f);
+
+    size_t quarter = n / 4;
+    from = 0;
+    to = 0;
+    for (size_t i = 0; i < quarter; i++)
+    {
+        from += s[i] / quarter;
+        to += s[n - quarter + i] / quarter;
+    }
+    return tau > SOAK_TREND && to > from * 1.05f;
+}
 
-    Image ship_image = LoadImage("assets/ships/spiked ship 3.PNG");
-    ImageResize(&ship_image, screenWidth / 10, screenHeight / 10);
-    game.textures.ship_tex = LoadTextureFromImage(ship_image);
+int soak_run(double seconds)
+{
+    const char *names[SOAK_SERIES] = {"rss MB", "asteroids", "projectiles", "enemy_projectiles", "enemies", "explosions", "powerups", "tick p99 us", "allocations"};
+    std::vector<float> series[SOAK_SERIES];
+    const int interval = SOAK_INTERVAL * game.sim_hz;
+    const long ticks = (long)(seconds * game.sim_hz);
+    std::vector<float> tick_us;
+    tick_us.reserve(interval);
+
+    mainloop_init();
+    game.delta = game.sim_dt;
+    int sessions = 1;
+    double longest = 0;
+    for (long tick = 0; tick < ticks; tick++)
+    {
+        frame_arena.reset();
+        game.inputs = autopilot_inputs();
+        auto start = std::chrono::steady_clock::now();
+        sim_advance(game.sim_dt);
+        auto end = std::chrono::steady_clock::now();
+        tick_us.push_back(std::chrono::duration<float, std::micro>(end - start).count());
+        hud_frame_end(tick_us.back() / 1e6f);
+        metrics_publish(tick_us.back() / 1e6f, sim_stats());
 
-    Image boost_image = LoadImage("assets/ships/boost_high.png");
-    ImageResize(&boost_image, screenWidth / 3, screenHeight / 2);
-    game.textures.boost_text = LoadTextureFromImage(boost_image);
+        if (game.var.ship.hp <= 0)
+        {
+            longest = fmax(longest, game.gametime);
+            sessions++;
+            mainloop_init();
+        }
+        if ((tick + 1) % interval)
+            continue;
 
-    Image ufo_image = LoadImage("assets/ships/ufo.png");
-    ImageResize(&ufo_image, screenWidth / 20, screenWidth / 20);
-    game.textures.ufo_tex = LoadTextureFromImage(ufo_image);
+        std::sort(tick_us.begin(), tick_us.end());
+        float p50 = tick_us[tick_us.size() / 2];
+        float p99 = tick_us[tick_us.size() * 99 / 100];
+        float sample[SOAK_SERIES] = {(float)(metrics_rss() / (1 << 20)), (float)game.asteroids.size(), (float)game.projectiles.size(), (float)game.enemy_projectiles.size(),
+                                     (float)game.enemies.size(), (float)game.explosions.size(), (float)game.powerups.size(), p99, (float)alloc_stats.game.load()};
+        for (int s = 0; s < SOAK_SERIES; s++)
+            series[s].push_back(sample[s]);
+        printf("soak %6lds rss %.1f MB asteroids %4.0f projectiles %3.0f/%3.0f enemies %3.0f explosions %3.0f powerups %3.0f tick p50 %.1f p99 %.1f max %.1f us session %d score %u\n",
+               (tick + 1) / game.sim_hz, sample[0], sample[1], sample[2], sample[3], sample[4], sample[5], sample[6], p50, p99, tick_us.back(), sessions, game.highscore);
+        fflush(stdout);
+        tick_us.clear();
+    }
+    longest = fmax(longest, game.gametime);
 
-    Image torpedo_image = LoadImage("assets/projectiles/torpedo.png");
-    ImageResize(&torpedo_image, screenWidth / 20, screenWidth / 20);
-    game.textures.torpedo_tex = LoadTextureFromImage(torpedo_image);
+    int growing = 0;
+    for (int s = 0; s < SOAK_SERIES; s++)
+    {
+        float from, to;
+        if (soak_growing(series[s], from, to))
+        {
+            printf("GROWTH: %s kept rising, %.1f -> %.1f\n", names[s], from, to);
+            growing++;
+        }
+    }
+    printf("soak %.0f s, %d sessions, longest %.0f s, %d growing series\n", seconds, sessions, longest, growing);
+    return growing ? 1 : 0;
+}
 
-    Image orb_red_image = LoadImage("assets/projectiles/orb_red.png");
-    ImageResize(&orb_red_image, screenWidth / 35, screenWidth / 35);
-    game.textures.orb_red = LoadTextureFromImage(orb_red_image);
+// removes entities from a pool and lets new ones take over their slots. the
+// handles to the removed ones have to stop resolving, the rest must not
+int pool_check()
+{
+    int failed = 0;
+    auto check = [&](bool ok, const char *what)
+    {
+        if (!ok)
+        {
+            printf("POOL: %s\n", what);
+            failed++;
+        }
+    };
 
-    Image explosion_atlas = LoadImage("assets/projectiles/explosion2.png");
-    Image explosion_1 = ImageFromImage(explosion_atlas, {373, 8, 236, 35});
-    game.textures.explosion_tex = LoadTextureFromImage(explosion_1);
-    Image shield_img = LoadImage("assets/ships/shield.png");
-    ImageResize(&shield_img, game.textures.ship_tex.width * 1.1, game.textures.ship_tex.width * 1.1);
-    game.textures.shield_tex = LoadTextureFromImage(shield_img);
+    pool_t<enemy_t> pool;
+    pool.reserve(4);
+    enemy_t enemy = game.var.enemy;
+    handle_t handles[3];
+    for (int i = 0; i < 3; i++)
+    {
+        enemy.hp = i;
+        handles[i] = pool.push_back(enemy);
+    }
 
-    load_textures_from_dir(game.textures.asteroid_textures, "./assets/asteroids");
+    // the last one is swapped into the hole
+    pool.remove(0);
+    check(!pool.slots.valid(handles[0]) && !pool.get(handles[0]), "removed entity still resolves");
+    check(pool.get(handles[2]) && pool.get(handles[2])->hp == 2, "swapped entity lost its handle");
 
-    game.textures.explosion2_tex = LoadTexture("assets/projectiles/exp2.png");
+    enemy.hp = 3;
+    handle_t reused = pool.push_back(enemy);
+    check(reused.index == handles[0].index, "freed slot was not reused");
+    check(!pool.slots.valid(handles[0]) && !pool.get(handles[0]), "stale handle resolves to the new entity");
+    check(pool.get(reused) && pool.get(reused)->hp == 3, "new entity doesnt resolve");
+    check(pool.get(handles[1]) && pool.get(handles[1])->hp == 1, "untouched entity doesnt resolve");
 
-    Image big_boom_imgage = LoadImage("assets/projectiles/exp2.png");
-    ImageResize(&big_boom_imgage, big_boom_imgage.width * 3, big_boom_imgage.height * 3);
-    game.textures.big_boom_tex = LoadTextureFromImage(big_boom_imgage);
+    while (!pool.full())
+        pool.push_back(enemy);
+    check(!pool.slots.valid(pool.push_back(enemy)), "full pool handed out a handle");
 
-    int bar_w = screenWidth / 5;
-    int bar_h = screenHeight / 15;
-    Image bar_b = LoadImage("assets/misc/BarBackground.png");
-    ImageResize(&bar_b, bar_w, bar_h);
-    game.textures.ui_bar_b = LoadTextureFromImage(bar_b);
+    pool.clear();
+    check(!pool.get(handles[1]) && !pool.get(handles[2]) && !pool.get(reused), "handle survived clear()");
+    check(!pool.get(handle_none), "handle_none resolved");
+
+    printf("POOL: %s\n", failed ? "failed" : "ok");
+    return failed ? 1 : 0;
+}
+
+// brute force against the grid on synthetic fields, half the entities are
+// asteroid sized circles and half are point projectiles, build time included
+int bench_broadphase()
+{
+    const int counts[] = {1000, 10000, 50000};
+    const float radius = 60;
+    grid_t grid;
+    grid.init(-screenWidth, -2 * screenHeight, 3 * screenWidth, 3 * screenHeight, 64);
+    srand(1);
+
+    printf("%10s %12s %12s %10s %12s\n", "entities", "brute ms", "grid ms", "speedup", "hits");
+    for (int n : counts)
+    {
+        std::vector<Vector2> targets(n / 2);
+        std::vector<Vector2> points(n / 2);
+        for (auto &t : targets)
+            t = {(float)(rand() % (3 * screenWidth) - screenWidth), (float)(rand() % (3 * screenHeight) - 2 * screenHeight)};
+        for (auto &p : points)
+            p = {(float)(rand() % (3 * screenWidth) - screenWidth), (float)(rand() % (3 * screenHeight) - 2 * screenHeight)};
+
+        auto start = std::chrono::steady_clock::now();
+        long brute_hits = 0;
+        for (auto &p : points)
+            for (auto &t : targets)
+                brute_hits += CheckCollisionPointCircle(p, t, radius);
+        auto mid = std::chrono::steady_clock::now();
+
+        long grid_hits = 0;
+        grid.build(targets.size(), radius, [&](size_t i)
+        {
+            return targets[i];
+        });
+        for (auto &p : points)
+            grid.query(p, 0, [&](uint32_t i)
+            {
+                grid_hits += CheckCollisionPointCircle(p, targets[i], radius);
+                return false;
+            });
+        auto end = std::chrono::steady_clock::now();
+
+        double brute_ms = std::chrono::duration<double, std::milli>(mid - start).count();
+        double grid_ms = std::chrono::duration<double, std::milli>(end - mid).count();
+        printf("%10d %12.3f %12.3f %9.1fx %12ld\n", n, brute_ms, grid_ms, brute_ms / grid_ms, grid_hits);
+        if (brute_hits != grid_hits)
+        {
+            printf("grid missed collisions: brute %ld grid %ld\n", brute_hits, grid_hits);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+bool snapshot_equal(const snapshot_t &a, const snapshot_t &b)
+{
+    if (a.tick != b.tick || a.inputs != b.inputs || a.state != b.state || a.hp != b.hp || a.shield != b.shield || a.x != b.x || a.y != b.y)
+        return false;
+    for (int c = 0; c < CONTAINERS; c++)
+    {
+        if (a.entities[c].size() != b.entities[c].size())
+            return false;
+        for (size_t i = 0; i < a.entities[c].size(); i++)
+        {
+            const snap_entity_t &ea = a.entities[c][i];
+            const snap_entity_t &eb = b.entities[c][i];
+            if (ea.slot != eb.slot || ea.generation != eb.generation || ea.x != eb.x || ea.y != eb.y)
+                return false;
+        }
+    }
+    return true;
+}
+
+// fills the game pools with n moving entities plus some churn, runs
+// multi_send() and decodes every snapshot on a simulated peer that acks
+// with a few ticks of lag. every decode has to match what was captured
+int bench_snapshot()
+{
+    const int counts[] = {100, 1000, 10000};
+    const int ticks = 240;
+    const uint32_t ack_lag = 3;
+    rng_t rng;
+    rng.seed(1);
+    game.window_width = screenWidth;
+    game.window_height = screenHeight;
+
+    std::vector<snapshot_t> peer(SNAP_HISTORY);
+    snapshot_t decoded;
+
+    printf("%10s %12s %12s %10s %12s %12s\n", "entities", "full bytes", "delta bytes", "B/entity", "encode us", "decode us");
+    for (int n : counts)
+    {
+        mainloop_init();
+        // the bench fields are bigger than any session
+        game.asteroids.reserve(n);
+        game.projectiles.reserve(n);
+        game.enemy_projectiles.reserve(n);
+        game.enemies.reserve(n);
+        game.explosions.reserve(n);
+        // the history and the peer have to keep up with the pools, otherwise
+        // the timed passes grow them
+        multi_reserve();
+        for (int c = 0; c < CONTAINERS; c++)
+        {
+            size_t capacity = game.net.history[0].entities[c].capacity();
+            for (auto &p : peer)
+                p.entities[c].reserve(capacity);
+            decoded.entities[c].reserve(capacity);
+        }
+        game.net.tick = 0;
+        game.net.acked = SNAP_NONE;
+        for (auto &p : peer)
+            p.tick = SNAP_NONE;
+
+        // half asteroids, a quarter projectiles, the rest split up
+        auto random_pos = [&]()
+        {
+            return Vector2{(float)rng.range(screenWidth), (float)rng.range(screenHeight)};
+        };
+        auto spawn = [&](int kind)
+        {
+            if (kind < 8)
+                game.asteroids.push_back((asteroid_t){nullptr, random_pos(), {0, 100}});
+            else if (kind < 12)
+                game.projectiles.push_back((projectile_t){nullptr, random_pos(), {0, -1}, 300, 50});
+            else if (kind < 14)
+                game.enemy_projectiles.push_back((projectile_t){nullptr, random_pos(), {0, 1}, 190, 100});
+            else if (kind < 15)
+            {
+                enemy_t enemy = game.var.enemy;
+                enemy.pos = random_pos();
+                game.enemies.push_back(enemy);
+            }
+            else
+            {
+                game.explosions.push_back(animation_start(CLIP_EXPLOSION2, random_pos(), 0));
+            }
+        };
+        for (int i = 0; i < n; i++)
+            spawn(i % 16);
+
+        size_t full_bytes = 0;
+        double delta_bytes = 0;
+        double encode_us = 0;
+        double decode_us = 0;
+        for (int tick = 0; tick < ticks; tick++)
+        {
+            frame_arena.reset();
+            // move everything but the explosions, swap out about 1% of the asteroids
+            for (size_t i = 0; i < game.asteroids.size(); i++)
+                game.asteroids.y[i] += 100 * game.sim_dt;
+            for (size_t i = 0; i < game.projectiles.size(); i++)
+                game.projectiles.y[i] -= 300 * game.sim_dt;
+            for (size_t i = 0; i < game.enemy_projectiles.size(); i++)
+                game.enemy_projectiles.y[i] += 190 * game.sim_dt;
+            for (auto &e : game.enemies)
+                e.pos.x += 250 * game.sim_dt;
+            for (int i = 0; i < n / 200 + 1 && !game.asteroids.empty(); i++)
+            {
+                game.asteroids.remove(rng.range(game.asteroids.size()));
+                spawn(0);
+            }
+            game.var.ship.pos.x += (tick / 60) % 2 ? -2 : 2;
 
-    Image bar_f = LoadImage("assets/misc/BarGlass.png");
-    ImageResize(&bar_f, bar_w, bar_h);
-    game.textures.ui_bar_f = LoadTextureFromImage(bar_f);
+            auto start = std::chrono::steady_clock::now();
+            multi_send();
+            auto mid = std::chrono::steady_clock::now();
+            bool ok = snapshot_decode(game.net.buffer, game.net.bytes, peer.data(), decoded);
+            auto end = std::chrono::steady_clock::now();
 
-    Image bar_red = LoadImage("assets/misc/RedBar.png");
-    ImageResize(&bar_red, bar_w, bar_h);
-    game.textures.ui_bar_red = LoadTextureFromImage(bar_red);
+            const snapshot_t &sent = game.net.history[(game.net.tick - 1) % SNAP_HISTORY];
+            if (!game.net.bytes || !ok || !snapshot_equal(sent, decoded))
+            {
+                printf("snapshot %d of %d entities didnt round trip\n", tick, n);
+                return 1;
+            }
+            uint32_t received = decoded.tick;
+            std::swap(peer[received % SNAP_HISTORY], decoded);
+            if (received >= ack_lag)
+                multi_ack(received - ack_lag);
 
-    Image bar_blue = LoadImage("assets/misc/BlueBar.png");
-    ImageResize(&bar_blue, bar_w, bar_h);
-    game.textures.ui_bar_blue = LoadTextureFromImage(bar_blue);
+            if (tick == 0)
+                full_bytes = game.net.bytes;
+            else
+                delta_bytes += game.net.bytes;
+            encode_us += std::chrono::duration<double, std::micro>(mid - start).count();
+            decode_us += std::chrono::duration<double, std::micro>(end - mid).count();
+        }
+        delta_bytes /= ticks - 1;
+        printf("%10d %12zu %12.0f %10.2f %12.2f %12.2f\n", n, full_bytes, delta_bytes, delta_bytes / n, encode_us / ticks, decode_us / ticks);
+    }
+    return 0;
+}
 
-    Image powup_life = LoadImage("assets/powerup/life.png");
-    Image powup_shield = LoadImage("assets/powerup/shield.png");
-    Image powup_weapon = LoadImage("assets/powerup/multi.png");
+void init_assets()
+{
+    TRACE_ZONE("init_assets");
+    bake_open();
 
+    int bar_w = screenWidth / 5;
+    int bar_h = screenHeight / 15;
     int pow_w = screenWidth / 8;
     int pow_h = screenHeight / 10;
-    ImageResize(&powup_life, pow_w, pow_h);
-    ImageResize(&powup_shield, pow_w, pow_h);
-    ImageResize(&powup_weapon, pow_w, pow_h);
-    game.textures.powup_life_tex = LoadTextureFromImage(powup_life);
-    game.textures.powup_shield_tex = LoadTextureFromImage(powup_shield);
-    game.textures.powup_weapon_tex = LoadTextureFromImage(powup_weapon);
 
-    font = LoadFont("assets/misc/sterion.ttf");
-    SetTextureFilter(font.texture, TEXTURE_FILTER_BILINEAR);
+    // decoding and resizing runs on all cores, only the uploads below stay on this thread
+    std::vector<image_job_t> jobs = {
+        {"assets/ships/spiked ship 3.PNG", screenWidth / 10, screenHeight / 10, &game.textures.ship_tex},
+        {"assets/ships/boost_high.png", screenWidth / 3, screenHeight / 2, &game.textures.boost_text},
+        {"assets/ships/ufo.png", screenWidth / 20, screenWidth / 20, &game.textures.ufo_tex},
+        {"assets/projectiles/torpedo.png", screenWidth / 20, screenWidth / 20, &game.textures.torpedo_tex},
+        {"assets/projectiles/orb_red.png", screenWidth / 35, screenWidth / 35, &game.textures.orb_red},
+        {"assets/projectiles/explosion2.png", 0, 0, nullptr},
+        {"assets/ships/shield.png", (int)(screenWidth / 10 * 1.1), (int)(screenWidth / 10 * 1.1), &game.textures.shield_tex},
+        {"assets/projectiles/exp2.png", 0, 0, &game.textures.explosion2_tex},
+        {"assets/misc/BarBackground.png", bar_w, bar_h, &game.textures.ui_bar_b},
+        {"assets/misc/BarGlass.png", bar_w, bar_h, &game.textures.ui_bar_f},
+        {"assets/misc/RedBar.png", bar_w, bar_h, &game.textures.ui_bar_red},
+        {"assets/misc/BlueBar.png", bar_w, bar_h, &game.textures.ui_bar_blue},
+        {"assets/powerup/life.png", pow_w, pow_h, &game.textures.powup_life_tex},
+        {"assets/powerup/shield.png", pow_w, pow_h, &game.textures.powup_shield_tex},
+        {"assets/powerup/multi.png", pow_w, pow_h, &game.textures.powup_weapon_tex},
+    };
+    const size_t explosion_job = 5;
+    const size_t explosion2_job = 7;
+
+    std::vector<std::string> asteroid_paths;
+    list_images_in_dir(asteroid_paths, "./assets/asteroids");
+    game.textures.asteroid_textures.resize(asteroid_paths.size());
+    for (size_t i = 0; i < asteroid_paths.size(); i++)
+        jobs.push_back({asteroid_paths[i], 0, 0, &game.textures.asteroid_textures[i]});
+    for (auto &layer : game.background)
+        jobs.push_back({layer.path, layer.size, layer.size, nullptr, &layer.texture});
+
+    uint64_t decode_begin = trace_now();
+    parallel_jobs(jobs.size(), [&](size_t i)
+    {
+        jobs[i].image = load_image_baked(jobs[i].path.c_str(), jobs[i].width, jobs[i].height);
+    });
+    trace_record("decode", decode_begin, trace_now());
+
+    // the big boom is scaled from the size of the decoded explosion sheet
+    Image explosion2_image = jobs[explosion2_job].image;
+    Image big_boom_imgage = load_image_baked("assets/projectiles/exp2.png", explosion2_image.width * 3, explosion2_image.height * 3);
 
-    // end load assets
+    // standalone textures, the background has to wrap so it can't live in the atlas
+    for (auto &job : jobs)
+    {
+        if (!job.texture)
+            continue;
+        *job.texture = load_texture_from_image(job.image);
+        UnloadImage(job.image);
+        int w = job.texture->width;
+        int h = job.texture->height;
+        if ((w & (w - 1)) || (h & (h - 1)))
+            printf("ASSETS: %s is %dx%d, repeat wrap needs a power of two on GLES2\n", job.path.c_str(), w, h);
+        if (!game.headless)
+            SetTextureWrap(*job.texture, TEXTURE_WRAP_REPEAT);
+    }
 
-    UnloadImage(big_boom_imgage);
-    UnloadImage(ship_image);
-    UnloadImage(boost_image);
-    UnloadImage(ufo_image);
-    UnloadImage(torpedo_image);
+    Image explosion_atlas = jobs[explosion_job].image;
+    Image explosion_1 = {0};
+    if (explosion_atlas.data != nullptr)
+        explosion_1 = ImageFromImage(explosion_atlas, {373, 8, 236, 35});
     UnloadImage(explosion_atlas);
-    UnloadImage(explosion_1);
-    UnloadImage(shield_img);
-    UnloadImage(orb_red_image);
-    UnloadImage(bar_b);
-    UnloadImage(bar_f);
-    UnloadImage(bar_red);
-    UnloadImage(bar_blue);
-    UnloadImage(powup_life);
-    UnloadImage(powup_shield);
-    UnloadImage(powup_weapon);
+
+    // everything else gets packed into the atlas
+    std::vector<atlas_entry_t> atlas;
+    for (auto &job : jobs)
+        if (job.sprite)
+            atlas.push_back({job.sprite, job.image});
+    atlas.push_back({&game.textures.explosion_tex, explosion_1});
+    atlas.push_back({&game.textures.big_boom_tex, big_boom_imgage});
+
+    bake_write();
+    atlas_build(atlas, game.textures.pages, 2048);
+
+    if (!game.headless)
+    {
+        font = LoadFont("assets/misc/sterion.ttf");
+        SetTextureFilter(font.texture, TEXTURE_FILTER_BILINEAR);
+    }
+
+    // end load assets
 }
 
 void init_sound()
 {
+    TRACE_ZONE("init_sound");
     game.sound.bg_music = LoadMusicStream("sound/music.mp3");
 
-    game.sound.explosion_sound = LoadSound("sound/explosion.wav");
-    game.sound.gunloop_sound = LoadSound("sound/gunloop.wav");
-    SetSoundVolume(game.sound.gunloop_sound, 0.1);
-    SetSoundVolume(game.sound.explosion_sound, 0.6);
-
     game.sound.opening = LoadMusicStream("sound/opening.mp3");
-    game.sound.click = LoadSound("sound/menu_click.wav");
-    game.sound.select = LoadSound("sound/menu_select.wav");
+
+    audio_load(SFX_EXPLOSION, "sound/explosion.wav", 0.6f, 6, 2);
+    audio_load(SFX_GUN, "sound/gunloop.wav", 0.1f, 2, 1);
+    audio_load(SFX_CLICK, "sound/menu_click.wav", 1.0f, 1, 3);
+    audio_load(SFX_SELECT, "sound/menu_select.wav", 1.0f, 1, 3);
+
+    // small buffers keep the effects close to the frame that triggered them
+    SetAudioStreamBufferSizeDefault(512);
+    audio.stream = LoadAudioStream(AUDIO_RATE, 32, 1);
+    SetAudioStreamBufferSizeDefault(0);
+    SetAudioStreamCallback(audio.stream, audio_callback);
+    PlayAudioStream(audio.stream);
+    audio.running = true;
 }
 
-void init_types()
+// rows frames side by side, cols rows of them, filled row by row
+void clip_init(_CLIP id, sprite_t *sprite, int rows, int cols, int frames, float frametime, _ANIM style)
 {
+    clip_t &clip = game.clips[id];
+    clip.sprite = sprite;
+    clip.width = (float)sprite->width / rows;
+    clip.height = (float)sprite->height / cols;
+    clip.frame_rate = 1.0f / frametime;
+    clip.style = style;
+    clip.frames.resize(frames);
+    for (int i = 0; i < frames; i++)
+        clip.frames[i] = {(i % rows) * clip.width, (i / rows) * clip.height, clip.width, clip.height};
+}
 
-    game.asteroids.reserve(100);
-    game.projectiles.reserve(100);
-    game.enemy_projectiles.reserve(100);
-    game.enemies.reserve(100);
-    game.explosions.reserve(100);
+void init_types()
+{
+    TRACE_ZONE("init_types");
+
+    game.asteroids.reserve(MAX_ASTEROIDS);
+    game.projectiles.reserve(MAX_PROJECTILES);
+    game.enemy_projectiles.reserve(MAX_ENEMY_PROJECTILES);
+    game.enemies.reserve(MAX_ENEMIES);
+    game.explosions.reserve(MAX_EXPLOSIONS);
+    game.powerups.reserve(MAX_POWERUPS);
+    game.broadphase.asteroids.reserve(MAX_ASTEROIDS);
+    game.broadphase.enemies.reserve(MAX_ENEMIES);
+    game.broadphase.dead_asteroids.reserve(MAX_ASTEROIDS);
+    game.broadphase.dead_projectiles.reserve(MAX_PROJECTILES);
+    game.broadphase.dead_enemies.reserve(MAX_ENEMIES);
+    render_reserve(MAX_ASTEROIDS + MAX_PROJECTILES + MAX_ENEMY_PROJECTILES + MAX_ENEMIES + MAX_EXPLOSIONS + MAX_POWERUPS);
 
     game.screencenter = {(float)screenWidth / 2, (float)screenHeight / 2};
     Vector2 spawnposition = {(float)screenWidth / 2, -50};
     game.ship_startpos = {(float)screenWidth / 2, (float)screenHeight * 0.95};
-    game.window_width = GetScreenWidth();
-    game.window_height = GetScreenHeight();
+    game.window_width = game.headless ? screenWidth : GetScreenWidth();
+    game.window_height = game.headless ? screenHeight : GetScreenHeight();
     game.textsize = (game.window_height + game.window_width) / 28;
 
+    // playfield plus the off-screen band asteroids_spawn() drops asteroids into
+    game.broadphase.asteroids.init(-screenWidth, -2 * screenHeight, 3 * screenWidth, 3 * screenHeight, 64);
+    game.broadphase.enemies.init(-screenWidth, -2 * screenHeight, 3 * screenWidth, 3 * screenHeight, 64);
+
     // weapon1
-    game.var.weapon1.texture = &game.textures.torpedo_tex;
+    game.var.weapon1.sprite = &game.textures.torpedo_tex;
     game.var.weapon1.direction = {0, -1};
     game.var.weapon1.speed = 300;
     game.var.weapon1.damage = 50;
 
     // weapon2
     projectile_t weapon2;
-    weapon2.texture = &game.textures.torpedo_tex;
+    weapon2.sprite = &game.textures.torpedo_tex;
     weapon2.direction = {0.3f, -1};
     weapon2.speed = 300;
     weapon2.damage = 50;
 
     projectile_t weapon3;
-    weapon3.texture = &game.textures.torpedo_tex;
+    weapon3.sprite = &game.textures.torpedo_tex;
     weapon3.direction = {-0.3f, -1};
     weapon3.speed = 300;
     weapon3.damage = 50;
 
     // enemy attack
-    game.var.enemy_attack.texture = &game.textures.orb_red;
+    game.var.enemy_attack.sprite = &game.textures.orb_red;
     game.var.enemy_attack.damage = 100;
     game.var.enemy_attack.speed = 190;
 
     // ship
-    game.var.ship.texture = &game.textures.ship_tex;
+    game.var.ship.sprite = &game.textures.ship_tex;
     game.var.ship.pos = game.ship_startpos;
     game.var.ship.speed = 300;
+    game.var.ship.base_speed = 300;
     game.var.ship.shooting_cooldown = 0.1f;
     game.var.ship.last_shot = 0;
     game.var.ship.hp = 3000;
     game.var.ship.max_hp = 3000;
+    game.var.ship.base_hp = 3000;
     game.var.ship.shield = 1500;
     game.var.ship.max_shield = 1500;
+    game.var.ship.base_shield = 1500;
     game.var.ship.shieldrecovertime = 2;
     game.var.ship.weaponarsenal.push_back(game.var.weapon1);
     game.var.ship.weaponarsenal.push_back(weapon2);
     game.var.ship.weaponarsenal.push_back(weapon3);
 
     // enemy
-    game.var.enemy_path = {spawnposition};
-    game.var.enemy.texture = &game.textures.ufo_tex;
+    game.var.enemy.sprite = &game.textures.ufo_tex;
     game.var.enemy.hp = 100;
     game.var.enemy.pos = spawnposition;
+    game.var.enemy.prev_pos = spawnposition;
     game.var.enemy.speed = 250;
     game.var.enemy.shooting_cooldown = 0.8f;
     game.var.enemy.last_shot = 0;
-    game.var.enemy.path = &game.var.enemy_path;
+    game.var.enemy.path_origin = spawnposition;
+    game.var.enemy.pathpos = 0;
 
     // animations
-    game.animations.explosion.texture = &game.textures.explosion_tex;
-    game.animations.explosion.frames = 7;
-    game.animations.explosion.rows = 7;
-    game.animations.explosion.cols = 1;
-    game.animations.explosion.framerec = {0.0f, 0.0f, (float)game.textures.explosion_tex.width / game.animations.explosion.rows, (float)game.textures.explosion_tex.height / game.animations.explosion.cols};
-    game.animations.explosion.framespeed = 0.02f;
-    game.animations.explosion.style = ONCE;
-
+    clip_init(CLIP_EXPLOSION, &game.textures.explosion_tex, 7, 1, 7, 0.02f, ONCE);
     // the main-explosion
-    game.animations.explosion2.texture = &game.textures.explosion2_tex;
-    game.animations.explosion2.rows = 4;
-    game.animations.explosion2.cols = 4;
-    game.animations.explosion2.frames = game.animations.explosion2.rows * game.animations.explosion2.cols;
-    game.animations.explosion2.framerec = {0.0f, 0.0f, (float)game.textures.explosion2_tex.width / game.animations.explosion2.rows, (float)game.textures.explosion2_tex.height / game.animations.explosion2.cols};
-    game.animations.explosion2.framespeed = 0.02f;
-    game.animations.explosion2.style = ONCE;
-
-    // big boom
-    game.animations.big_boom.texture = &game.textures.big_boom_tex;
-    game.animations.big_boom.currentframe = 0;
-    game.animations.big_boom.framespeed = 0.015f;
-    game.animations.big_boom.rows = 4;
-    game.animations.big_boom.cols = 4;
-    game.animations.big_boom.framerec = {0.0f, 0.0f, (float)game.textures.big_boom_tex.width / game.animations.big_boom.rows, (float)game.textures.big_boom_tex.height / game.animations.big_boom.cols};
-    game.animations.big_boom.frames = game.animations.big_boom.rows * game.animations.big_boom.cols;
-    game.animations.big_boom.style = ONCE;
-
-    game.animations.boost.texture = &game.textures.boost_text;
-    game.animations.boost.currentframe = 0;
-    game.animations.boost.framespeed = 0.008f;
-    game.animations.boost.rows = 8;
-    game.animations.boost.cols = 8;
-    game.animations.boost.framerec = {0.0f, 0.0f, (float)game.textures.boost_text.width / game.animations.boost.rows, (float)game.textures.boost_text.height / game.animations.boost.cols};
-    game.animations.boost.frames = game.animations.boost.rows * game.animations.boost.cols;
-    game.animations.boost.style = LOOP;
-
-    game.animations.powup_life.texture = &game.textures.powup_life_tex;
-    game.animations.powup_life.currentframe = 0;
-    game.animations.powup_life.framespeed = 0.1f;
-    game.animations.powup_life.rows = 2;
-    game.animations.powup_life.cols = 1;
-    game.animations.powup_life.framerec = {0.0f, 0.0f, (float)game.textures.powup_life_tex.width / game.animations.powup_life.rows, (float)game.textures.powup_life_tex.height / game.animations.powup_life.cols};
-    game.animations.powup_life.frames = game.animations.powup_life.rows * game.animations.powup_life.cols;
-    game.animations.powup_life.style = LOOP;
-
-    game.animations.powup_shield.texture = &game.textures.powup_shield_tex;
-    game.animations.powup_shield.currentframe = 0;
-    game.animations.powup_shield.framespeed = 0.1f;
-    game.animations.powup_shield.rows = 2;
-    game.animations.powup_shield.cols = 1;
-    game.animations.powup_shield.framerec = {0.0f, 0.0f, (float)game.textures.powup_shield_tex.width / game.animations.powup_shield.rows, (float)game.textures.powup_shield_tex.height / game.animations.powup_shield.cols};
-    game.animations.powup_shield.frames = game.animations.powup_life.rows * game.animations.powup_life.cols;
-    game.animations.powup_shield.style = LOOP;
-
-    game.animations.powup_weapon.texture = &game.textures.powup_weapon_tex;
-    game.animations.powup_weapon.currentframe = 0;
-    game.animations.powup_weapon.framespeed = 0.1f;
-    game.animations.powup_weapon.rows = 2;
-    game.animations.powup_weapon.cols = 1;
-    game.animations.powup_weapon.framerec = {0.0f, 0.0f, (float)game.textures.powup_weapon_tex.width / game.animations.powup_weapon.rows, (float)game.textures.powup_life_tex.height / game.animations.powup_weapon.cols};
-    game.animations.powup_weapon.frames = game.animations.powup_weapon.rows * game.animations.powup_weapon.cols;
-    game.animations.powup_weapon.style = LOOP;
-    // bg variables
-    game.bg_scollspeed = 100;
-    game.bg_scrollpos = 0.0f;
-}
-
-int main(void)
+    clip_init(CLIP_EXPLOSION2, &game.textures.explosion2_tex, 4, 4, 16, 0.02f, ONCE);
+    clip_init(CLIP_BIG_BOOM, &game.textures.big_boom_tex, 4, 4, 16, 0.015f, ONCE);
+    clip_init(CLIP_BOOST, &game.textures.boost_text, 8, 8, 64, 0.008f, LOOP);
+    clip_init(CLIP_POWUP_LIFE, &game.textures.powup_life_tex, 2, 1, 2, 0.1f, LOOP);
+    clip_init(CLIP_POWUP_SHIELD, &game.textures.powup_shield_tex, 2, 1, 2, 0.1f, LOOP);
+    clip_init(CLIP_POWUP_WEAPON, &game.textures.powup_weapon_tex, 2, 1, 2, 0.1f, LOOP);
+    game.var.boost = animation_start(CLIP_BOOST, game.var.ship.pos, 0);
+
+}
+
+int main(int argc, char **argv)
 {
+    alloc_game_thread = true;
+    trace_thread_name("main");
+    int headless_ticks = 0;
+    int alloc_ticks = 0;
+    double soak_seconds = 0;
+    int job_threads = 0;
+    int metrics_port = 0;
+    bool governor_on = false;
+    bool governor_off = false;
+    const char *script_path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--hz") && i + 1 < argc)
+            game.sim_hz = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--headless") && i + 1 < argc)
+            headless_ticks = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--alloc-check") && i + 1 < argc)
+            alloc_ticks = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--soak") && i + 1 < argc)
+            soak_seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--autopilot"))
+            game.autopilot = true;
+        else if (!strcmp(argv[i], "--governor"))
+            governor_on = true;
+        else if (!strcmp(argv[i], "--no-governor"))
+            governor_off = true;
+        else if (!strcmp(argv[i], "--budget") && i + 1 < argc)
+            governor.budget_ms = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--jobs") && i + 1 < argc)
+            job_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--input") && i + 1 < argc)
+            script_path = argv[++i];
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+        {
+            game.seed = strtoull(argv[++i], nullptr, 0);
+            game.seed_fixed = true;
+        }
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+        {
+            trace.path = argv[++i];
+            trace.dump_on_exit = true;
+        }
+        else if (!strcmp(argv[i], "--metrics") && i + 1 < argc)
+            metrics_port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--level") && i + 1 < argc)
+        {
+            if (!level_open(argv[++i]))
+                return 1;
+        }
+        else if (!strcmp(argv[i], "--compile-level") && i + 2 < argc)
+        {
+            i += 2;
+            return level_compile(argv[i - 1], argv[i]);
+        }
+        else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+            replay.record_path = argv[++i];
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+        {
+            if (!replay_load(argv[++i]))
+                return 1;
+        }
+        else if (!strcmp(argv[i], "--bench-broadphase"))
+            return bench_broadphase();
+        else if (!strcmp(argv[i], "--bench-snapshot"))
+            return bench_snapshot();
+        else if (!strcmp(argv[i], "--pool-check"))
+            return pool_check();
+        else if (!strcmp(argv[i], "--bake"))
+        {
+            // rebuild the asset pack from the source images and exit
+            game.headless = true;
+            bake_cache.rebuild = true;
+            init_assets();
+            return 0;
+        }
+    }
+    if (game.sim_hz <= 0)
+        game.sim_hz = 120;
+    if (governor.budget_ms <= 0)
+        governor.budget_ms = 1000.0f / 60;
+    if (replay.playing && replay.header.level_hash != level_hash())
+    {
+        printf("REPLAY: recorded on a different level, pass the same --level\n");
+        return 1;
+    }
+    game.sim_dt = 1.0f / game.sim_hz;
+    if (metrics_port > 0)
+        metrics_start(metrics_port);
+    jobs_start(job_threads);
+
+    if (headless_ticks > 0 || alloc_ticks > 0 || soak_seconds > 0)
+    {
+        game.headless = true;
+        // headless runs are reproducible unless asked otherwise, the governor
+        // reacts to timing so it has to be asked for
+        game.seed_fixed = true;
+        governor.enabled = governor_on;
+        SetTraceLogLevel(LOG_WARNING);
+        init_assets();
+        init_types();
+        int result;
+        if (soak_seconds > 0)
+            result = soak_run(soak_seconds);
+        else if (alloc_ticks > 0)
+            result = alloc_check(alloc_ticks);
+        else
+            result = headless_run(headless_ticks, script_path);
+        if (trace.dump_on_exit)
+            trace_dump(trace.path);
+        return result;
+    }
+
+    governor.enabled = !governor_off;
     InitWindow(screenWidth, screenHeight, "FGradius");
     //SetTargetFPS(60);
 
@@ -1374,11 +5923,17 @@ int main(void)
         if (game.var.ship.player == 0)
         {
             fly_to_start();
+            replay_session_begin();
             mainloop();
+            replay_session_end();
             gameover();
         }
         if (WindowShouldClose())
+        {
+            if (trace.dump_on_exit)
+                trace_dump(trace.path);
             return 0;
+        }
         BeginDrawing();
         EndDrawing();
     }